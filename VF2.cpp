@@ -3,438 +3,3734 @@
 #include <cstring>
 #include <assert.h>
 #include <ctime>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include <algorithm>
-#include <iterator>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <set>
-#include <sstream>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
 typedef int VIndex;
 typedef int EIndex;
 typedef int VLabel;
+typedef int ELabel;
 const VIndex NULL_VIndex = -1;
 const EIndex NULL_EIndex = -1;
-const set<VIndex> NULL_VERTEX_SET = {};
+const ELabel NULL_ELabel = -1;
 
 struct Edge {
-  int u, v, label, next, prev;
-  Edge(int u, int v, int l, int n, int p): u(u), v(v), label(l), next(n), prev(p) {}
+  int u, v, label;
+  Edge(int u, int v, int l): u(u), v(v), label(l) {}
+};
+
+/*
+* Read-only slice of a sorted CSR neighbor array
+*/
+struct VRange {
+  const VIndex *first, *last;
+  const VIndex *begin() const { return first; }
+  const VIndex *end() const { return last; }
+  int size() const { return last - first; }
 };
 
 /*
 * Graph structure
 *
+* A graph is a read-only view of compressed sparse rows owned by a GraphSet:
+* the successors of u are out_adj[out_offset[u] .. out_offset[u + 1]), and
+* out_label holds the label of each of those edges. The in_* arrays hold the
+* same for predecessors. Every row is sorted by (vertex label of the
+* neighbor, edge label, neighbor id), so the neighbors reached through one
+* edge label and carrying one vertex label form a group sorted by id, found
+* by binary search, and an edge of known label is a binary search too.
+*
+* Attributes
+* ----------
+* vertex_count: int, number of vertices
+* edge_count: int, number of edges
+* vertex: array, length = `vertex_count`, label of each vertex
+* out_offset, in_offset: array, length = `vertex_count` + 1, row offsets
+* out_adj, in_adj: array, length = `edge_count`, successors / predecessors
+* out_label, in_label: array, length = `edge_count`, edge labels
+* color: array, length = `vertex_count`, stable color of each vertex, see
+*        refineColors
+* signature: uint64, hash of the multiset of colors, equal for isomorphic
+*            graphs
+* label_count: int, 1 + the largest label of the label index, 0 without one
+* label_begin, label_vertex: arrays, the vertices with label l are
+*                            label_vertex[label_begin[l] .. label_begin[l + 1])
+*
+* Methods
+* -------
+* succ, pred: successors / predecessors of a vertex
+* withLabel: the vertices with a label, when the label index exists
+* seek: position of the first edge of a row not ordered before (l, e, v)
+* succWithLabel, predWithLabel: the group of the successors / predecessors
+*     of a vertex with a vertex label, along edges with an edge label
+* hasEdge: whether edge `u` -> `v` exists with a label
+* edgeLabel: label of edge `u` -> `v`, or NULL_ELabel if there is none
+* printGraphInfo: print graph structure
+*/
+struct Graph {
+  int edge_count, vertex_count;
+  const VLabel *vertex;
+  const EIndex *out_offset, *in_offset;
+  const VIndex *out_adj, *in_adj;
+  const ELabel *out_label, *in_label;
+  const int32_t *color;
+  uint64_t signature;
+  int label_count;
+  const int32_t *label_begin;
+  const VIndex *label_vertex;
+
+  VRange succ(VIndex u) const {
+    return VRange{out_adj + out_offset[u], out_adj + out_offset[u + 1]};
+  }
+
+  VRange pred(VIndex u) const {
+    return VRange{in_adj + in_offset[u], in_adj + in_offset[u + 1]};
+  }
+
+  VRange withLabel(VLabel l) const {
+    if (l < 0 || l >= label_count) return VRange{label_vertex, label_vertex};
+    return VRange{label_vertex + label_begin[l], label_vertex + label_begin[l + 1]};
+  }
+
+  EIndex seek(const VIndex *adj, const ELabel *label, EIndex first, EIndex last,
+              VLabel l, ELabel e, VIndex v) const {
+    auto key = make_tuple(l, e, v);
+    while (first < last) {
+      EIndex mid = first + (last - first) / 2;
+      if (make_tuple(vertex[adj[mid]], label[mid], adj[mid]) < key) first = mid + 1;
+      else last = mid;
+    }
+    return first;
+  }
+
+  VRange succWithLabel(VIndex u, VLabel l, ELabel e) const {
+    EIndex first = seek(out_adj, out_label, out_offset[u], out_offset[u + 1], l, e, NULL_VIndex);
+    EIndex last = seek(out_adj, out_label, first, out_offset[u + 1], l, e + 1, NULL_VIndex);
+    return VRange{out_adj + first, out_adj + last};
+  }
+
+  VRange predWithLabel(VIndex u, VLabel l, ELabel e) const {
+    EIndex first = seek(in_adj, in_label, in_offset[u], in_offset[u + 1], l, e, NULL_VIndex);
+    EIndex last = seek(in_adj, in_label, first, in_offset[u + 1], l, e + 1, NULL_VIndex);
+    return VRange{in_adj + first, in_adj + last};
+  }
+
+  bool hasEdge(VIndex u, VIndex v, ELabel e) const {
+    EIndex i = seek(out_adj, out_label, out_offset[u], out_offset[u + 1], vertex[v], e, v);
+    return i < out_offset[u + 1] && out_adj[i] == v && out_label[i] == e;
+  }
+
+  ELabel edgeLabel(VIndex u, VIndex v) const {
+    // try the edge label groups of the neighbors labeled like v in turn
+    EIndex last = out_offset[u + 1];
+    EIndex i = seek(out_adj, out_label, out_offset[u], last, vertex[v],
+                    numeric_limits<ELabel>::min(), v);
+    while (i < last && vertex[out_adj[i]] == vertex[v]) {
+      ELabel e = out_label[i];
+      i = seek(out_adj, out_label, i, last, vertex[v], e, v);
+      if (i < last && out_adj[i] == v && out_label[i] == e) return e;
+      i = seek(out_adj, out_label, i, last, vertex[v], e + 1, NULL_VIndex);
+    }
+    return NULL_ELabel;
+  }
+
+  void printGraphInfo() const {
+    printf("vertex count: %d\n", vertex_count);
+    printf("vertex label:\n");
+    for (VIndex u = 0; u < vertex_count; u++) printf("%d ", vertex[u]);
+    puts("");
+    printf("vertex predecessors:\n");
+    for (VIndex u = 0; u < vertex_count; u++) {
+      printf("No.%d:", u);
+      for (auto v: pred(u)) {
+        printf(" %d", v);
+      }
+      puts("");
+    }
+    printf("edge count: %d\n", edge_count);
+    puts("");
+  }
+};
+
+static inline uint64_t mixHash(uint64_t x) {
+  // splitmix64 finalizer
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/*
+* Intersection of strictly increasing int32 arrays
+*
+* intersectSorted writes the values a[0 .. na) and b[0 .. nb) have in
+* common to `out`, in increasing order, and returns their number. `out`
+* needs room for min(na, nb) values and may be `a` itself, so a list can be
+* narrowed in place. Every kernel also has a `size` entry that only counts
+* them, which the benchmark times alongside.
+*
+* There are three kernels. The scalar one is a branch-free merge. The
+* vector ones compare a block of a with every rotation of a block of b (4
+* lanes with SSE2, 8 with AVX2), which finds all matches between the two
+* blocks, then move past the block with the smaller last value. The
+* matches of a block of a are only written once the kernel moves past it,
+* so writing never overtakes reading when `out` is `a`; finishSorted
+* completes a block left half-matched, and the scalar merge handles the
+* tails. SSE2 is part of x86-64, so the SSE2 kernel needs no check; the
+* AVX2 one is compiled for AVX2 and popcnt alone and used only if the CPU
+* has both, so the binary still runs everywhere.
+*
+* Methods
+* -------
+* intersectKernel: the fastest kernel this CPU supports
+* intersectSorted: run it
+*/
+struct IntersectKernel {
+  const char *name;
+  size_t (*size)(const int32_t *a, size_t na, const int32_t *b, size_t nb);
+  size_t (*sorted)(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+};
+
+static size_t mergeSize(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                        size_t i = 0, size_t j = 0) {
+  size_t k = 0;
+  while (i < na && j < nb) {
+    int32_t x = a[i], y = b[j];
+    k += x == y;
+    i += x <= y;
+    j += y <= x;
+  }
+  return k;
+}
+
+static size_t mergeSorted(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                          int32_t *out, size_t i = 0, size_t j = 0) {
+  // out[k] is at most a[i], which has already been read
+  size_t k = 0;
+  while (i < na && j < nb) {
+    int32_t x = a[i], y = b[j];
+    out[k] = x;
+    k += x == y;
+    i += x <= y;
+    j += y <= x;
+  }
+  return k;
+}
+
+// the tails of a vector kernel stopped at a[i], b[j]: the `width` values
+// a[i ..] of a block whose lanes in `pending` matched earlier values of b
+// are finished one by one, so out[k] never passes the value being read
+static size_t finishSorted(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                           int32_t *out, size_t k, size_t i, size_t j, int pending, int width) {
+  if (pending) {
+    for (int l = 0; l < width; l++) {
+      int32_t x = a[i + l];
+      while (j < nb && b[j] < x) j++;
+      if ((pending >> l & 1) || (j < nb && b[j] == x)) out[k++] = x;
+    }
+    i += width;
+  }
+  return k + mergeSorted(a, na, b, nb, out + k, i, j);
+}
+
+static size_t scalarSize(const int32_t *a, size_t na, const int32_t *b, size_t nb) {
+  return mergeSize(a, na, b, nb);
+}
+
+static size_t scalarSorted(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                           int32_t *out) {
+  return mergeSorted(a, na, b, nb, out);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef __SSE2__
+// bit l of the result is set iff lane l of a[i .. i + 4) is in b[j .. j + 4)
+static inline int sseMatch(const int32_t *a, const int32_t *b) {
+  __m128i va = _mm_loadu_si128((const __m128i *)a);
+  __m128i vb = _mm_loadu_si128((const __m128i *)b);
+  __m128i eq = _mm_cmpeq_epi32(va, vb);
+  eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+  eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))));
+  eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+  return _mm_movemask_ps(_mm_castsi128_ps(eq));
+}
+
+static size_t sseSize(const int32_t *a, size_t na, const int32_t *b, size_t nb) {
+  size_t i = 0, j = 0, k = 0;
+  while (i + 4 <= na && j + 4 <= nb) {
+    // popcount of the 4-bit mask from a nibble table packed in a constant,
+    // x86-64 does not guarantee the popcnt instruction
+    k += (0x4332322132212110ULL >> (sseMatch(a + i, b + j) * 4)) & 15;
+    int32_t x = a[i + 3], y = b[j + 3];
+    i += x <= y ? 4 : 0;
+    j += y <= x ? 4 : 0;
+  }
+  return k + mergeSize(a, na, b, nb, i, j);
+}
+
+static size_t sseSorted(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                        int32_t *out) {
+  size_t i = 0, j = 0, k = 0;
+  int pending = 0;
+  while (i + 4 <= na && j + 4 <= nb) {
+    pending |= sseMatch(a + i, b + j);
+    int32_t x = a[i + 3], y = b[j + 3];
+    j += y <= x ? 4 : 0;
+    if (x > y) continue;
+    for (; pending; pending &= pending - 1) out[k++] = a[i + __builtin_ctz(pending)];
+    i += 4;
+  }
+  return finishSorted(a, na, b, nb, out, k, i, j, pending, 4);
+}
+#endif
+
+// lanes of va equal to a lane of the same 128-bit half of vb
+__attribute__((target("avx2")))
+static inline __m256i avxHalfMatch(__m256i va, __m256i vb) {
+  __m256i r1 = _mm256_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+  __m256i r2 = _mm256_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2));
+  __m256i r3 = _mm256_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3));
+  __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi32(va, vb), _mm256_cmpeq_epi32(va, r1));
+  return _mm256_or_si256(eq, _mm256_or_si256(_mm256_cmpeq_epi32(va, r2),
+                                             _mm256_cmpeq_epi32(va, r3)));
+}
+
+// bit l of the result is set iff lane l of a[i .. i + 8) is in b[j .. j + 8);
+// the halves of b are compared as they are and swapped, so the shuffles
+// do not depend on each other
+__attribute__((target("avx2")))
+static inline int avxMatch(const int32_t *a, const int32_t *b) {
+  __m256i va = _mm256_loadu_si256((const __m256i *)a);
+  __m256i vb = _mm256_loadu_si256((const __m256i *)b);
+  __m256i eq = _mm256_or_si256(avxHalfMatch(va, vb),
+                               avxHalfMatch(va, _mm256_permute2x128_si256(vb, vb, 1)));
+  return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t avxSize(const int32_t *a, size_t na, const int32_t *b, size_t nb) {
+  size_t i = 0, j = 0, k = 0;
+  while (i + 8 <= na && j + 8 <= nb) {
+    k += __builtin_popcount(avxMatch(a + i, b + j));
+    int32_t x = a[i + 7], y = b[j + 7];
+    i += x <= y ? 8 : 0;
+    j += y <= x ? 8 : 0;
+  }
+  return k + mergeSize(a, na, b, nb, i, j);
+}
+
+__attribute__((target("avx2")))
+static size_t avxSorted(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                        int32_t *out) {
+  size_t i = 0, j = 0, k = 0;
+  int pending = 0;
+  while (i + 8 <= na && j + 8 <= nb) {
+    pending |= avxMatch(a + i, b + j);
+    int32_t x = a[i + 7], y = b[j + 7];
+    j += y <= x ? 8 : 0;
+    if (x > y) continue;
+    for (; pending; pending &= pending - 1) out[k++] = a[i + __builtin_ctz(pending)];
+    i += 8;
+  }
+  return finishSorted(a, na, b, nb, out, k, i, j, pending, 8);
+}
+#endif
+
+// every kernel this build has, slowest first, whether or not the CPU runs it
+vector<IntersectKernel> intersectKernels() {
+  vector<IntersectKernel> kernels(1, IntersectKernel{"scalar", scalarSize, scalarSorted});
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef __SSE2__
+  kernels.push_back(IntersectKernel{"sse2", sseSize, sseSorted});
+#endif
+  kernels.push_back(IntersectKernel{"avx2", avxSize, avxSorted});
+#endif
+  return kernels;
+}
+
+bool kernelSupported(const IntersectKernel &kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (!strcmp(kernel.name, "avx2")) {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  }
+#endif
+  return true;
+}
+
+const IntersectKernel &intersectKernel() {
+  static const IntersectKernel kernel = []() {
+    vector<IntersectKernel> kernels = intersectKernels();
+    while (!kernelSupported(kernels.back())) kernels.pop_back();
+    return kernels.back();
+  }();
+  return kernel;
+}
+
+static inline size_t intersectSorted(const int32_t *a, size_t na, const int32_t *b, size_t nb,
+                                     int32_t *out) {
+  return intersectKernel().sorted(a, na, b, nb, out);
+}
+
+/*
+* Color refinement (1-dimensional Weisfeiler-Leman) of G
+*
+* Every vertex starts with a hash of its label. A round recolors u with a
+* hash of its color and of the multisets of (edge label, color) of its
+* successors and of its predecessors, each multiset hashed as a sum of mixed
+* element hashes so no sorting is needed. Rounds stop once they no longer
+* split any color class. Colors are hashes rather than class numbers, so
+* they compare across graphs: an isomorphism maps every vertex to one of the
+* same color, and isomorphic graphs get the same signature, which folds the
+* number of rounds, the counts and the sorted colors. Equal signatures or
+* colors do not prove anything, different ones rule a mapping out.
+*
+* Fills color (length G.vertex_count) and returns the signature.
+*/
+uint64_t refineColors(const Graph &G, int32_t *color) {
+  int count = G.vertex_count;
+  vector<uint32_t> current(count), next(count), sorted;
+  for (VIndex u = 0; u < count; u++) current[u] = mixHash(G.vertex[u]);
+  auto classes = [&](const vector<uint32_t> &c) {
+    sorted = c;
+    sort(sorted.begin(), sorted.end());
+    return unique(sorted.begin(), sorted.end()) - sorted.begin();
+  };
+  long class_count = classes(current);
+  int rounds = 0;
+  while (class_count < count) {
+    for (VIndex u = 0; u < count; u++) {
+      uint64_t out = 0, in = 0;
+      for (EIndex eid = G.out_offset[u]; eid < G.out_offset[u + 1]; eid++) {
+        out += mixHash((uint64_t)(uint32_t)G.out_label[eid] << 32 | current[G.out_adj[eid]]);
+      }
+      for (EIndex eid = G.in_offset[u]; eid < G.in_offset[u + 1]; eid++) {
+        in += mixHash((uint64_t)(uint32_t)G.in_label[eid] << 32 | current[G.in_adj[eid]]);
+      }
+      next[u] = mixHash(mixHash(current[u] ^ mixHash(out)) ^ in);
+    }
+    long next_count = classes(next);
+    if (next_count == class_count) break;
+    current.swap(next);
+    class_count = next_count;
+    rounds++;
+  }
+  sorted = current;
+  sort(sorted.begin(), sorted.end());
+  uint64_t signature = mixHash(((uint64_t)rounds << 32) ^ count) ^ mixHash(G.edge_count);
+  for (auto c: sorted) signature = mixHash(signature ^ c);
+  for (VIndex u = 0; u < count; u++) color[u] = current[u];
+  return signature;
+}
+
+/*
+* A collection of graphs stored as a handful of flat arrays
+*
+* The arrays (sections) of all graphs are concatenated: graph g owns vertices
+* vertex_begin[g] .. vertex_begin[g + 1] of VERTEX_LABEL, edges
+* edge_begin[g] .. edge_begin[g + 1] of the adjacency and edge label
+* sections, and vertex_begin[g] + g .. vertex_begin[g + 1] + g of the offset
+* sections, whose values are local to the graph. The vertex colors and two
+* words of signature per graph (low word first) are computed by addGraph
+* and saved with the rest. The sections either live in
+* `storage` (graphs parsed from text) or in a read-only memory mapping of a
+* binary database file, which is then used in place: loading maps the file
+* and computes the Graph views, nothing else is read or allocated, and
+* processes opening the same file share the page cache.
+*
+* Binary file layout: a DBHeader, a table of `section_count` DBSection
+* entries, then the sections, each an int32 array starting at an 8-byte
+* aligned file offset.
+*
+* Attributes
+* ----------
+* graphs: vector, Graph views into the sections
+* section: array, start of each section
+* storage: array of vector, sections of a collection built in memory
+* map_base, map_size: the mapped file, if any
+* refine: bool, whether addGraph refines colors; when it is off, colors and
+*         signatures are left 0, which only isomorphism relies on
+* label_index: array of vector, the label index of every graph, see
+*              indexLabels
+*
+* Methods
+* -------
+* addGraph: append a graph whose `count` vertex labels have just been pushed
+*     to storage[VERTEX_LABEL], given its edge list, and refine its colors
+* link: compute the Graph views once all graphs have been added
+* indexLabels: build the label index of every graph, kept in memory only
+* save: write the collection as a binary database file
+* load: map a binary database file; DB_NOT_BINARY if `path` does not start
+*     with the magic of one, DB_UNUSABLE if it does but has another version
+*     or a section table that does not fit the file and the counts it holds
+* clear: drop all graphs and unmap the file
+* version: hash of the format version and of the labels and out-rows of
+*     every graph, which changes whenever the collection does
+*/
+enum {
+  VERTEX_BEGIN, EDGE_BEGIN, VERTEX_LABEL,
+  OUT_OFFSET, OUT_ADJ, OUT_LABEL, IN_OFFSET, IN_ADJ, IN_LABEL,
+  VERTEX_COLOR, GRAPH_SIGNATURE,
+  SECTION_COUNT
+};
+
+const char DB_MAGIC[8] = {'V', 'F', '2', 'G', 'D', 'B', '\0', '\0'};
+const int DB_VERSION = 4;
+
+enum DBLoad { DB_LOADED, DB_NOT_BINARY, DB_UNUSABLE };
+
+struct DBHeader {
+  char magic[8];
+  int32_t version;
+  int32_t section_count;
+  int64_t graph_count;
+};
+
+struct DBSection {
+  int64_t offset;
+  int64_t length;
+};
+
+struct GraphSet {
+  vector<Graph> graphs;
+  const int32_t *section[SECTION_COUNT];
+  vector<int32_t> storage[SECTION_COUNT];
+  void *map_base;
+  size_t map_size;
+  bool refine;
+  vector<int32_t> label_index[2];
+
+  GraphSet(): map_base(NULL), map_size(0), refine(true) { clear(); }
+  GraphSet(const GraphSet &) = delete;
+  GraphSet &operator=(const GraphSet &) = delete;
+  ~GraphSet() { clear(); }
+
+  size_t size() const { return graphs.size(); }
+  const Graph &operator[](size_t g) const { return graphs[g]; }
+  vector<Graph>::const_iterator begin() const { return graphs.begin(); }
+  vector<Graph>::const_iterator end() const { return graphs.end(); }
+
+  void clear() {
+    if (map_base) munmap(map_base, map_size);
+    map_base = NULL;
+    map_size = 0;
+    graphs.clear();
+    for (int k = 0; k < SECTION_COUNT; k++) storage[k].clear();
+    for (int k = 0; k < 2; k++) label_index[k].clear();
+    storage[VERTEX_BEGIN].push_back(0);
+    storage[EDGE_BEGIN].push_back(0);
+    for (int k = 0; k < SECTION_COUNT; k++) section[k] = storage[k].data();
+  }
+
+  // rows of the edges, grouped as Graph expects; `vertex` labels the vertices.
+  // Parallel edges are dropped from `edges` itself, keeping the one with the
+  // smallest label, so the rows built from it afterwards in the other
+  // direction hold the same edges
+  static void buildRows(int count, const VLabel *vertex, vector<Edge> &edges,
+                        vector<int32_t> &offset, vector<int32_t> &adj, vector<int32_t> &label) {
+    auto less = [](const Edge &a, const Edge &b) {
+      return make_tuple(a.u, a.v, a.label) < make_tuple(b.u, b.v, b.label);
+    };
+    auto same = [](const Edge &a, const Edge &b) { return a.u == b.u && a.v == b.v; };
+    // edge lists are usually written in order, so check before sorting
+    if (!is_sorted(edges.begin(), edges.end(), less)) sort(edges.begin(), edges.end(), less);
+    edges.erase(unique(edges.begin(), edges.end(), same), edges.end());
+    size_t first = offset.size(), base = adj.size();
+    offset.resize(first + count + 1, 0);
+    int32_t *row = &offset[first];
+    for (size_t i = 0; i < edges.size(); i++) {
+      row[edges[i].u + 1]++;
+      adj.push_back(edges[i].v);
+      label.push_back(edges[i].label);
+    }
+    for (int u = 0; u < count; u++) row[u + 1] += row[u];
+    // then regroup every row by (vertex label, edge label), ids sorted within
+    vector<tuple<VLabel, ELabel, VIndex>> group;
+    for (int u = 0; u < count; u++) {
+      group.clear();
+      for (int32_t i = base + row[u]; i < (int32_t)base + row[u + 1]; i++) {
+        group.push_back(make_tuple(vertex[adj[i]], label[i], adj[i]));
+      }
+      if (is_sorted(group.begin(), group.end())) continue;
+      sort(group.begin(), group.end());
+      for (size_t i = 0; i < group.size(); i++) {
+        adj[base + row[u] + i] = get<2>(group[i]);
+        label[base + row[u] + i] = get<1>(group[i]);
+      }
+    }
+  }
+
+  void addGraph(int count, vector<Edge> &edge) {
+    size_t v = storage[VERTEX_BEGIN].back(), e = storage[EDGE_BEGIN].back();
+    const VLabel *vertex = storage[VERTEX_LABEL].data() + v;
+    buildRows(count, vertex, edge, storage[OUT_OFFSET], storage[OUT_ADJ], storage[OUT_LABEL]);
+    for (auto &e: edge) swap(e.u, e.v);
+    buildRows(count, vertex, edge, storage[IN_OFFSET], storage[IN_ADJ], storage[IN_LABEL]);
+    // a view of the rows just built, to refine the colors of the new graph
+    size_t o = storage[OUT_OFFSET].size() - count - 1;
+    Graph G;
+    G.vertex_count = count;
+    G.edge_count = storage[OUT_ADJ].size() - e;
+    G.vertex = storage[VERTEX_LABEL].data() + v;
+    G.out_offset = storage[OUT_OFFSET].data() + o;
+    G.in_offset = storage[IN_OFFSET].data() + o;
+    G.out_adj = storage[OUT_ADJ].data() + e;
+    G.in_adj = storage[IN_ADJ].data() + e;
+    G.out_label = storage[OUT_LABEL].data() + e;
+    G.in_label = storage[IN_LABEL].data() + e;
+    storage[VERTEX_COLOR].resize(v + count, 0);
+    uint64_t signature = refine ? refineColors(G, storage[VERTEX_COLOR].data() + v) : 0;
+    storage[GRAPH_SIGNATURE].push_back((uint32_t)signature);
+    storage[GRAPH_SIGNATURE].push_back((uint32_t)(signature >> 32));
+    storage[VERTEX_BEGIN].push_back(storage[VERTEX_LABEL].size());
+    storage[EDGE_BEGIN].push_back(storage[OUT_ADJ].size());
+  }
+
+  void link() {
+    if (!map_base) {
+      for (int k = 0; k < SECTION_COUNT; k++) section[k] = storage[k].data();
+    }
+    int64_t graph_count = map_base ? ((const DBHeader *)map_base)->graph_count :
+                                     (int64_t)storage[VERTEX_BEGIN].size() - 1;
+    graphs.resize(graph_count);
+    for (int64_t g = 0; g < graph_count; g++) {
+      int32_t v = section[VERTEX_BEGIN][g], e = section[EDGE_BEGIN][g];
+      Graph &G = graphs[g];
+      G.vertex_count = section[VERTEX_BEGIN][g + 1] - v;
+      G.edge_count = section[EDGE_BEGIN][g + 1] - e;
+      G.vertex = section[VERTEX_LABEL] + v;
+      G.out_offset = section[OUT_OFFSET] + v + g;
+      G.in_offset = section[IN_OFFSET] + v + g;
+      G.out_adj = section[OUT_ADJ] + e;
+      G.in_adj = section[IN_ADJ] + e;
+      G.out_label = section[OUT_LABEL] + e;
+      G.in_label = section[IN_LABEL] + e;
+      G.color = section[VERTEX_COLOR] + v;
+      G.signature = (uint32_t)section[GRAPH_SIGNATURE][2 * g] |
+                    (uint64_t)(uint32_t)section[GRAPH_SIGNATURE][2 * g + 1] << 32;
+      G.label_count = 0;
+      G.label_begin = G.label_vertex = NULL;
+    }
+  }
+
+  void indexLabels() {
+    enum { BEGIN, VERTEX };
+    int label_count = 0;
+    for (auto &G: graphs) {
+      for (VIndex u = 0; u < G.vertex_count; u++) label_count = max(label_count, G.vertex[u] + 1);
+    }
+    label_index[BEGIN].resize((label_count + 1) * graphs.size());
+    label_index[VERTEX].resize(sectionLength(VERTEX_LABEL));
+    for (size_t g = 0; g < graphs.size(); g++) {
+      Graph &G = graphs[g];
+      int32_t v = section[VERTEX_BEGIN][g];
+      int32_t *begin = label_index[BEGIN].data() + (label_count + 1) * g;
+      VIndex *vertex = label_index[VERTEX].data() + v;
+      for (VIndex u = 0; u < G.vertex_count; u++) begin[G.vertex[u] + 1]++;
+      for (int l = 0; l < label_count; l++) begin[l + 1] += begin[l];
+      vector<int32_t> next(begin, begin + label_count);
+      for (VIndex u = 0; u < G.vertex_count; u++) vertex[next[G.vertex[u]]++] = u;
+      G.label_count = label_count;
+      G.label_begin = begin;
+      G.label_vertex = vertex;
+    }
+  }
+
+  uint64_t version() const {
+    uint64_t h = mixHash(DB_VERSION ^ (uint64_t)size() << 32);
+    auto add = [&h](const int32_t *first, const int32_t *last) {
+      h = mixHash(h ^ (uint64_t)(last - first) << 32);
+      for (; first != last; first++) h = mixHash(h ^ (uint32_t)*first);
+    };
+    // the in-rows follow from the out-rows, the colors from both
+    for (auto &G: graphs) {
+      add(G.vertex, G.vertex + G.vertex_count);
+      add(G.out_offset, G.out_offset + G.vertex_count + 1);
+      add(G.out_adj, G.out_adj + G.edge_count);
+      add(G.out_label, G.out_label + G.edge_count);
+    }
+    return h;
+  }
+
+  int64_t sectionLength(int k) const {
+    int64_t graph_count = size();
+    return sectionLength(k, graph_count, section[VERTEX_BEGIN][graph_count],
+                         section[EDGE_BEGIN][graph_count]);
+  }
+
+  static int64_t sectionLength(int k, int64_t graph_count, int64_t vertices, int64_t edges) {
+    switch (k) {
+      case VERTEX_BEGIN: case EDGE_BEGIN: return graph_count + 1;
+      case VERTEX_LABEL: case VERTEX_COLOR: return vertices;
+      case GRAPH_SIGNATURE: return 2 * graph_count;
+      case OUT_OFFSET: case IN_OFFSET: return vertices + graph_count;
+      default: return edges;
+    }
+  }
+
+  bool save(const char *path) const {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+    DBHeader header;
+    memcpy(header.magic, DB_MAGIC, sizeof(DB_MAGIC));
+    header.version = DB_VERSION;
+    header.section_count = SECTION_COUNT;
+    header.graph_count = size();
+    DBSection table[SECTION_COUNT];
+    int64_t offset = sizeof(header) + sizeof(table);
+    for (int k = 0; k < SECTION_COUNT; k++) {
+      table[k].offset = offset;
+      table[k].length = sectionLength(k);
+      offset += (table[k].length * sizeof(int32_t) + 7) / 8 * 8;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(table, sizeof(table), 1, fp) == 1;
+    const char padding[8] = {0};
+    for (int k = 0; k < SECTION_COUNT && ok; k++) {
+      size_t bytes = table[k].length * sizeof(int32_t);
+      ok = fwrite(section[k], 1, bytes, fp) == bytes &&
+           fwrite(padding, 1, (8 - bytes % 8) % 8, fp) == (8 - bytes % 8) % 8;
+    }
+    return fclose(fp) == 0 && ok;
+  }
+
+  DBLoad load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return DB_NOT_BINARY;
+    struct stat st;
+    DBHeader header;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, DB_MAGIC, sizeof(DB_MAGIC)) != 0) {
+      close(fd);
+      return DB_NOT_BINARY;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      fprintf(stderr, "%s: cannot map the database\n", path);
+      return DB_UNUSABLE;
+    }
+    const DBSection *table = (const DBSection *)((const char *)base + sizeof(DBHeader));
+    if (header.version != DB_VERSION || header.section_count != SECTION_COUNT ||
+        (size_t)st.st_size < sizeof(DBHeader) + sizeof(DBSection) * SECTION_COUNT) {
+      fprintf(stderr, "%s: unsupported database version, convert it again\n", path);
+      munmap(base, st.st_size);
+      return DB_UNUSABLE;
+    }
+    if (!checkSections(header, table, base, st.st_size)) {
+      fprintf(stderr, "%s: truncated or corrupt database\n", path);
+      munmap(base, st.st_size);
+      return DB_UNUSABLE;
+    }
+    clear();
+    map_base = base;
+    map_size = st.st_size;
+    for (int k = 0; k < SECTION_COUNT; k++) {
+      section[k] = (const int32_t *)((const char *)base + table[k].offset);
+    }
+    link();
+    return DB_LOADED;
+  }
+
+  // whether every section lies in the file, aligned, with the length the
+  // graph, vertex and edge counts imply, and the graph bounds are increasing
+  static bool checkSections(const DBHeader &header, const DBSection *table, const void *base,
+                            int64_t file_size) {
+    int64_t graph_count = header.graph_count;
+    if (graph_count < 0 || graph_count >= numeric_limits<int32_t>::max()) return false;
+    for (int k = 0; k < SECTION_COUNT; k++) {
+      if (table[k].offset < 0 || table[k].offset % 8 != 0 || table[k].length < 0 ||
+          table[k].offset > file_size ||
+          table[k].length > (file_size - table[k].offset) / (int64_t)sizeof(int32_t)) {
+        return false;
+      }
+    }
+    const int32_t *begin[2];
+    for (int k = VERTEX_BEGIN; k <= EDGE_BEGIN; k++) {
+      if (table[k].length != graph_count + 1) return false;
+      begin[k] = (const int32_t *)((const char *)base + table[k].offset);
+      if (begin[k][0] != 0) return false;
+      for (int64_t g = 0; g < graph_count; g++) if (begin[k][g + 1] < begin[k][g]) return false;
+    }
+    int64_t vertices = begin[VERTEX_BEGIN][graph_count], edges = begin[EDGE_BEGIN][graph_count];
+    for (int k = 0; k < SECTION_COUNT; k++) {
+      if (table[k].length != sectionLength(k, graph_count, vertices, edges)) return false;
+    }
+    return true;
+  }
+};
+GraphSet database, query;
+
+/*
+* Parse a t/v/e text file into G
+*
+* The file is read with one fread and tokenized by hand. A first pass counts
+* the v and e lines so G's storage is allocated once. Vertex labels then go
+* straight into it, and edges into one scratch buffer reused by every graph.
+* Each "t # id" line starts a graph, "t # -1" (or the end of the file) ends
+* the collection, and at most `total` graphs are read, all if total < 0.
+*/
+static const char *skipBlank(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '#')) p++;
+  return p;
+}
+
+static const char *parseInt(const char *p, const char *end, int &x) {
+  p = skipBlank(p, end);
+  bool negative = p < end && *p == '-';
+  if (negative) p++;
+  x = 0;
+  while (p < end && *p >= '0' && *p <= '9') x = x * 10 + (*p++ - '0');
+  if (negative) x = -x;
+  return p;
+}
+
+bool readGraph(GraphSet &G, const char *path, int total) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) return false;
+  fseek(fp, 0, SEEK_END);
+  long length = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  unique_ptr<char[]> text(new char[length]);
+  bool ok = fread(text.get(), 1, length, fp) == (size_t)length;
+  fclose(fp);
+  if (!ok) return false;
+  const char *begin = text.get(), *end = begin + length;
+
+  size_t graph_lines = 0, vertex_lines = 0, edge_lines = 0;
+  for (const char *p = begin; p < end; p++) {
+    if (*p == 't') graph_lines++;
+    else if (*p == 'v') vertex_lines++;
+    else if (*p == 'e') edge_lines++;
+    p = (const char *)memchr(p, '\n', end - p);
+    if (!p) break;
+  }
+  G.storage[VERTEX_BEGIN].reserve(graph_lines + 1), G.storage[EDGE_BEGIN].reserve(graph_lines + 1);
+  G.storage[VERTEX_LABEL].reserve(vertex_lines), G.storage[VERTEX_COLOR].reserve(vertex_lines);
+  G.storage[GRAPH_SIGNATURE].reserve(2 * graph_lines);
+  G.storage[OUT_OFFSET].reserve(vertex_lines + graph_lines);
+  G.storage[IN_OFFSET].reserve(vertex_lines + graph_lines);
+  G.storage[OUT_ADJ].reserve(edge_lines), G.storage[OUT_LABEL].reserve(edge_lines);
+  G.storage[IN_ADJ].reserve(edge_lines), G.storage[IN_LABEL].reserve(edge_lines);
+
+  vector<Edge> edge;
+  edge.reserve(1024);
+  bool in_graph = false;
+  int graph_count = 0;
+  auto finishGraph = [&]() {
+    if (!in_graph) return;
+    int first = G.storage[VERTEX_BEGIN].back();
+    G.addGraph(G.storage[VERTEX_LABEL].size() - first, edge);
+    edge.clear();
+    in_graph = false;
+    graph_count++;
+  };
+  for (const char *p = begin; p < end; ) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (!eol) eol = end;
+    char type = *p;
+    int a, b, c;
+    if (type == 't') {
+      finishGraph();
+      parseInt(p + 1, eol, a);
+      if (a == -1 || graph_count == total) break;
+      in_graph = true;
+    } else if (type == 'v' && in_graph) {
+      parseInt(parseInt(p + 1, eol, a), eol, b);
+      G.storage[VERTEX_LABEL].push_back(b);
+    } else if (type == 'e' && in_graph) {
+      parseInt(parseInt(parseInt(p + 1, eol, a), eol, b), eol, c);
+      edge.push_back(Edge(a, b, c));
+    }
+    p = eol + 1;
+  }
+  finishGraph();
+  G.link();
+  printf("Total size: %d\n", (int)G.size());
+  return true;
+}
+
+/*
+* Load a graph collection from a binary database file, or parse it from the
+* t/v/e text format if `path` is not one. Exits if `path` cannot be read, or
+* is a binary database of another version or a damaged one.
+*/
+void loadGraphSet(GraphSet &G, const char *path, int total) {
+  G.clear();
+  DBLoad loaded = G.load(path);
+  if (loaded == DB_LOADED) {
+    printf("Total size: %d\n", (int)G.size());
+    return;
+  }
+  // a binary database that cannot be used is not text either
+  if (loaded == DB_UNUSABLE) exit(1);
+  if (!readGraph(G, path, total)) {
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(1);
+  }
+}
+
+/*
+* Everything computed once per query, before it meets the database
+*
+* Queries with at most MAX_MASK_WORDS * 64 vertices also get their adjacency
+* as bit masks, so the query side of the look-ahead rules is a few popcounts.
+*
+* Attributes
+* ----------
+* order: vector, matching order, see genMatchOrder
+* parent: vector, parent[d] is a neighbor of order[d] placed before it in
+*         the order (its anchor), or NULL_VIndex for a component root
+* parent_succ: vector, parent_succ[d] is 1 if order[d] is a successor of
+*              its anchor, 0 if it is a predecessor
+* parent_label: vector, label of the edge between order[d] and its anchor
+* backward: vector, backward[d] lists the other neighbors of order[d]
+*           placed before it, as Anchor entries; a vertex that is both a
+*           successor and a predecessor appears twice
+* propagate: bool, filter the candidate domains by neighborhood
+*            all-different before and during the search, see State
+* words: int, 64-bit words per mask row (1, 2, 4 or 8), 0 without masks
+* succ_mask, pred_mask: vector, length = vertex_count * words, row u has
+*                       bit v set iff u -> v (resp. v -> u)
+*/
+const int MAX_MASK_WORDS = 8;
+
+// a neighbor placed earlier, the label of the edge to it, and whether the
+// later vertex is its successor
+struct Anchor {
+  VIndex vertex;
+  ELabel label;
+  bool succ;
+};
+
+struct QueryPlan {
+  vector<VIndex> order;
+  vector<VIndex> parent;
+  vector<char> parent_succ;
+  vector<ELabel> parent_label;
+  vector<vector<Anchor>> backward;
+  bool propagate;
+  int words;
+  vector<uint64_t> succ_mask, pred_mask;
+};
+
+/*
+* Matching semantics, passed to State as a template policy
+*
+* induced: edges between matched G2 vertices must also exist in G1
+* feasible: how a G1 cardinality of the look-ahead rules must relate to
+*           the G2 one, and the vertex / edge counts of the graphs
+*
+* Isomorphism: G1 and G2 are the same graph
+* InducedSubgraph: G1 is isomorphic to an induced subgraph of G2
+* Monomorphism: G1 is isomorphic to a subgraph of G2, extra edges allowed
+*/
+enum MatchMode { ISOMORPHISM, INDUCED_SUBGRAPH, MONOMORPHISM };
+
+struct Isomorphism {
+  static const MatchMode mode = ISOMORPHISM;
+  static const bool induced = true;
+  static constexpr const char *name = "Isomorphism";
+  static bool feasible(int card_1, int card_2) { return card_1 == card_2; }
+};
+
+struct InducedSubgraph {
+  static const MatchMode mode = INDUCED_SUBGRAPH;
+  static const bool induced = true;
+  static constexpr const char *name = "Subgraph isomorphism";
+  static bool feasible(int card_1, int card_2) { return card_1 <= card_2; }
+};
+
+struct Monomorphism {
+  static const MatchMode mode = MONOMORPHISM;
+  static const bool induced = false;
+  static constexpr const char *name = "Monomorphism";
+  static bool feasible(int card_1, int card_2) { return card_1 <= card_2; }
+};
+
+/*
+* Per-target-vertex arrays of State, reused from one search to the next
+*
+* A search only touches the target vertices near its partial mappings, so
+* the arrays are not cleared between searches: every entry carries the
+* epoch of the search that last wrote it, and an entry from an older epoch
+* reads as cleared. Starting a search is then O(1), plus growing the arrays
+* the first time a larger target comes along. Each worker thread owns one.
+*
+* Attributes
+* ----------
+* epoch: uint32, the number of the current search
+* stamp: vector, epoch in which each entry was last written
+* core: vector, the query vertex paired with each target vertex, or NULL_VIndex
+* in, out: vector, depth tags of T2in(s) + M2(s) and T2out(s) + M2(s)
+* domain: if not NULL, the domains of the query of the coming searches in
+*         their target, as listDomains lists them, taken by initDomains
+*         instead of scanning the target again
+*
+* Methods
+* -------
+* reset: start a search on a target of `count` vertices
+* touch: clear an entry of an older epoch before writing it
+* fresh: whether an entry was written in the current epoch
+* coreOf, inOf, outOf: read an entry, cleared if it is not fresh
+*/
+struct TargetWorkspace {
+  uint32_t epoch;
+  vector<uint32_t> stamp;
+  vector<VIndex> core;
+  vector<int> in, out;
+  const vector<vector<VIndex>> *domain;
+
+  TargetWorkspace(): epoch(0), domain(NULL) {}
+
+  void reset(int count) {
+    if ((int)stamp.size() < count) {
+      stamp.resize(count, 0);
+      core.resize(count);
+      in.resize(count);
+      out.resize(count);
+    }
+    if (++epoch == 0) {
+      // the counter wrapped around, old stamps could look fresh
+      fill(stamp.begin(), stamp.end(), 0);
+      epoch = 1;
+    }
+  }
+
+  void touch(VIndex v) {
+    if (stamp[v] == epoch) return;
+    stamp[v] = epoch;
+    core[v] = NULL_VIndex;
+    in[v] = out[v] = 0;
+  }
+
+  bool fresh(VIndex v) const { return stamp[v] == epoch; }
+  VIndex coreOf(VIndex v) const { return fresh(v) ? core[v] : NULL_VIndex; }
+  int inOf(VIndex v) const { return fresh(v) ? in[v] : 0; }
+  int outOf(VIndex v) const { return fresh(v) ? out[v] : 0; }
+};
+
+/*
+* Possible state
+*
+* The terminal sets are per-vertex arrays in the style of the original VF2
+* implementation: in_1[u] is the depth (the size of M(s)) at which u entered
+* T1in(s) or M1(s), and 0 while it is in neither. A vertex keeps its tag once
+* it is matched, so T1in(s) = {u | in_1[u] != 0 and core_1[u] == NULL_VIndex}
+* and |T1in(s)| = in_1_len - core_len. backTrack clears exactly the tags equal
+* to the current depth, which makes membership tests and undo O(1) per vertex.
+*
+* The query side is owned by the state and sized to the query. The target
+* side (core_2, in_2, out_2) lives in a TargetWorkspace the caller passes in,
+* so a search against a huge target costs nothing per target vertex it never
+* reaches.
+*
+* Policy fixes the matching semantics at compile time (see Isomorphism),
+* so every feasibility rule compiles to a branch-free comparison.
+*
+* The domain of u is the set of target vertices compatible with it: same
+* label, in / out degrees feasible with those of u, and the same color for
+* isomorphism. It is listed only where the search iterates it, for the
+* roots of the query components, and is otherwise tested vertex by vertex.
+* When the target has a label index, domains are drawn from the vertices
+* with the right label. Anchored candidates always come from the group of
+* the anchor row with the label of u and the label of the anchoring edge.
+*
+* When the plan asks for it, the domains are also filtered LAD-style: v
+* stays in the domain of u only while the successors of u can be paired
+* injectively with successors of v in their domains along edges of the same
+* label, and likewise for predecessors. This neighborhood all-different
+* check runs to a fixpoint before the search and again after every pair
+* the search adds, once the partner of n is fixed and m is taken out of the
+* other domains. Every domain is then listed, with a flag per entry, and
+* removed candidates are pushed on `trail`, so backtracking puts them back.
+*
+* A vertex with more than one neighbor placed before it takes its
+* candidates from the G2 rows of the partners of all of them, intersected
+* into candidate[d] (see intersectSorted), when the anchor row has at
+* least INTERSECT_MIN vertices. Shorter rows are cheaper to filter one
+* candidate at a time in checkPredRule and checkSuccRule.
+*
+* With W > 0 the query side is mirrored in W-word bit masks (in_1_mask,
+* out_1_mask, core_1_mask), and the query half of checkInRule, checkOutRule
+* and checkNewRule intersects them with the QueryPlan adjacency masks.
+*
+* Attributes
+* ----------
+* vertex_count: int, the number of vertexes in query graph
+* order: vector, order[d] is the query vertex matched at depth d
+* plan: QueryPlan, adjacency masks of the query when W > 0
+* work: TargetWorkspace, the target side of the state
+* core_len: int, the depth of the state, i.e. |M1(s)| = |M2(s)|
+* in_1: vector, depth tags of T1in(s) + M1(s), the nodes that are the origin
+*       of edges ending into G1(s)
+* out_1: vector, depth tags of T1out(s) + M1(s), the nodes that are the
+*        destination of edges starting from G1(s)
+* in_1_len, in_2_len, out_1_len, out_2_len: int, number of tagged nodes
+* in_1_mask, out_1_mask, core_1_mask: array, W words, bit u is set iff
+*             in_1[u], out_1[u] and core_1[u] are set
+* core_1: vector, core_1[u] is the target vertex paired with u if u is in
+*         M1(s), or NULL_VIndex otherwise
+* domain: vector, domain[u] lists the domain of u in increasing order, for
+*         the vertices whose domain is listed
+* alive: vector, alive[u][i] is 0 once domain[u][i] has been filtered out
+* domain_size: vector, number of candidates left in each listed domain
+* trail: vector, the (u, i) candidates filtered out so far, in order
+* candidate: vector, candidate[d] holds the intersected candidates of depth
+*            d, when it has several placed neighbors
+* frame: vector, length = vertex_count, search stack of solve(): frame[d]
+*        holds the query vertex n of depth d, its current partner m, and a
+*        cursor over the remaining candidates, row[pos .. end) of a G2 CSR
+*        row or of domain[n], and the trail size before m was added
+*
+* Methods
+* -------
+* compatible: whether v is in the domain of u, before filtering
+* initDomains: list the domains, false if some domain is empty; `roots`, if
+*     given, are the only candidates of the first vertex of the order, and
+*     the other domains are copied from work.domain when it is set
+* admissible: whether v is in the domain of u and has not been filtered out
+* removeCandidate, restoreDomains: filter out a candidate, undo the trail
+* checkNeighborhood: the neighborhood all-different check of (u, v)
+* filterDomains: filter the neighbors of the queued query vertices until
+*     nothing changes, false if some domain runs empty
+* propagate: filter the domains once n is paired with m
+* genCandiPairSet: computation of the candidate pairs set P(s), a cursor
+*     pairing the next query vertex in `order` with the admissible vertices
+*     of G2
+* nextCandidate: advance a frame's cursor to the next free G2 vertex of the
+*     domain of its query vertex
+* addNewPair: add a mapping pair (n, m) to current state and update attributes
+* backTrack: undo the last addNewPair(n, m), restoring the previous state
+* checkPredRule, checkSuccRule: check consistency of the partial solution M(s')
+*     obtained by adding the considered candidate pair(n, m) to current state
+* checkInRule, checkOutRule: pruning the search tree, perform a 1-look-ahead in
+*     the searching process
+* checkNewRule: pruning the search tree, a 2-look-ahead; for non-induced
+*     matching it compares all unmatched neighbors, since the partner of a
+*     new query neighbor may already be in T2(s)
+* terminal_size: int, return the number of vertices of a range in T(s)
+* mask_terminal_size, mask_new_size: the same for a query mask row
+* new_size: int, return the number of vertices of a range outside M(s) and T(s)
+* checkSynRules: check all synatic feasibility rules
+* checkSemRules: check nodes attributes and edge attributes
+*/
+const int INTERSECT_MIN = 16;
+
+template <class Policy, int W>
+struct State {
+  int vertex_count;
+  const vector<VIndex> *order;
+  const QueryPlan *plan;
+  TargetWorkspace &work;
+  int core_len;
+  vector<int> in_1, out_1;
+  int in_1_len, in_2_len, out_1_len, out_2_len;
+  uint64_t in_1_mask[W ? W : 1], out_1_mask[W ? W : 1], core_1_mask[W ? W : 1];
+  vector<VIndex> core_1;
+  vector<vector<VIndex>> domain;
+  vector<vector<char>> alive;
+  vector<int> domain_size;
+  vector<pair<VIndex, int>> trail;
+  vector<vector<VIndex>> candidate;
+  // scratch of checkNeighborhood, filterDomains and propagate
+  vector<int> arc_begin, arc_to, owner, seen;
+  vector<char> queued;
+  vector<VIndex> changed;
+  int stamp;
+
+  struct Frame {
+    VIndex n, m;
+    const VIndex *row;
+    int pos, end;
+    size_t trail;
+  };
+  vector<Frame> frame;
+
+  State(const QueryPlan &_plan, TargetWorkspace &_work, int _count2): work(_work) {
+    int _count1 = _plan.order.size();
+    vertex_count = _count1;
+    order = &_plan.order;
+    plan = &_plan;
+    core_len = 0;
+    for (int i = 0; i < W; i++) in_1_mask[i] = out_1_mask[i] = core_1_mask[i] = 0;
+    core_1.assign(_count1, NULL_VIndex);
+    in_1.assign(_count1, 0);
+    out_1.assign(_count1, 0);
+    work.reset(_count2);
+    in_1_len = in_2_len = out_1_len = out_2_len = 0;
+    frame.resize(_count1);
+    candidate.resize(_count1);
+    // every query vertex is queued at most once
+    if (_plan.propagate) changed.reserve(_count1);
+    stamp = 0;
+  }
+
+  bool compatible(const Graph &G1, const Graph &G2, VIndex u, VIndex v) const {
+    if (G1.vertex[u] != G2.vertex[v]) return false;
+    if (Policy::mode == ISOMORPHISM && G1.color[u] != G2.color[v]) return false;
+    return Policy::feasible(G1.succ(u).size(), G2.succ(v).size()) &&
+           Policy::feasible(G1.pred(u).size(), G2.pred(v).size());
+  }
+
+  bool initDomains(const Graph &G1, const Graph &G2, const VRange *roots = NULL) {
+    domain.assign(vertex_count, vector<VIndex>());
+    alive.assign(vertex_count, vector<char>());
+    domain_size.assign(vertex_count, 0);
+    vector<char> listed(vertex_count, plan->propagate);
+    for (int d = 0; d < vertex_count; d++) {
+      if (plan->parent[d] == NULL_VIndex) listed[(*order)[d]] = 1;
+    }
+    for (VIndex u = 0; u < vertex_count; u++) {
+      bool found = false;
+      auto consider = [&](VIndex v) {
+        if (!compatible(G1, G2, u, v)) return true;
+        found = true;
+        if (listed[u]) domain[u].push_back(v);
+        return listed[u] != 0;
+      };
+      if (roots && u == (*order)[0]) {
+        for (auto v: *roots) consider(v);
+      } else if (work.domain) {
+        // listed and checked for emptiness once for all searches
+        domain[u] = (*work.domain)[u];
+        found = true;
+      } else if (G2.label_vertex) {
+        for (auto v: G2.withLabel(G1.vertex[u])) if (!consider(v)) break;
+      } else {
+        for (VIndex v = 0; v < G2.vertex_count; v++) if (!consider(v)) break;
+      }
+      if (!found) return false;
+      alive[u].assign(domain[u].size(), 1);
+      domain_size[u] = domain[u].size();
+    }
+    // a listed candidate is on the trail at most once
+    size_t listed_count = 0;
+    for (VIndex u = 0; u < vertex_count; u++) listed_count += domain[u].size();
+    trail.reserve(listed_count);
+    return true;
+  }
+
+  // position of v in the listed domain of u, -1 if it is not there
+  int position(VIndex u, VIndex v) const {
+    auto it = lower_bound(domain[u].begin(), domain[u].end(), v);
+    return it != domain[u].end() && *it == v ? it - domain[u].begin() : -1;
+  }
+
+  bool admissible(VIndex u, VIndex v) const {
+    int i = position(u, v);
+    return i >= 0 && alive[u][i];
+  }
+
+  bool removeCandidate(VIndex u, int i) {
+    alive[u][i] = 0;
+    trail.push_back(make_pair(u, i));
+    return --domain_size[u] > 0;
+  }
+
+  void restoreDomains(size_t mark) {
+    while (trail.size() > mark) {
+      alive[trail.back().first][trail.back().second] = 1;
+      domain_size[trail.back().first]++;
+      trail.pop_back();
+    }
+  }
+
+  // Kuhn's augmenting path from left vertex i of the bipartite graph
+  bool augment(int i) {
+    for (int a = arc_begin[i]; a < arc_begin[i + 1]; a++) {
+      int j = arc_to[a];
+      if (seen[j] == stamp) continue;
+      seen[j] = stamp;
+      if (owner[j] < 0 || augment(owner[j])) {
+        owner[j] = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // can every neighbor adj1[i] be given its own neighbor adj2[j] in its
+  // domain, along an edge of the same label
+  bool matchNeighbors(const VIndex *adj1, const ELabel *label1, int degree1,
+                      const VIndex *adj2, const ELabel *label2, int degree2) {
+    if (degree1 > degree2) return false;
+    arc_begin.assign(1, 0);
+    arc_to.clear();
+    for (int i = 0; i < degree1; i++) {
+      for (int j = 0; j < degree2; j++) {
+        if (label1[i] == label2[j] && admissible(adj1[i], adj2[j])) arc_to.push_back(j);
+      }
+      if ((int)arc_to.size() == arc_begin.back()) return false;
+      arc_begin.push_back(arc_to.size());
+    }
+    owner.assign(degree2, -1);
+    if ((int)seen.size() < degree2) seen.resize(degree2, 0);
+    for (int i = 0; i < degree1; i++) {
+      stamp++;
+      if (!augment(i)) return false;
+    }
+    return true;
+  }
+
+  bool checkNeighborhood(const Graph &G1, const Graph &G2, VIndex u, VIndex v) {
+    EIndex o1 = G1.out_offset[u], o2 = G2.out_offset[v];
+    if (!matchNeighbors(G1.out_adj + o1, G1.out_label + o1, G1.out_offset[u + 1] - o1,
+                        G2.out_adj + o2, G2.out_label + o2, G2.out_offset[v + 1] - o2)) {
+      return false;
+    }
+    EIndex i1 = G1.in_offset[u], i2 = G2.in_offset[v];
+    return matchNeighbors(G1.in_adj + i1, G1.in_label + i1, G1.in_offset[u + 1] - i1,
+                          G2.in_adj + i2, G2.in_label + i2, G2.in_offset[v + 1] - i2);
+  }
+
+  bool filterDomains(const Graph &G1, const Graph &G2, vector<VIndex> &queue) {
+    queued.assign(vertex_count, 0);
+    for (auto u: queue) queued[u] = 1;
+    auto filter = [&](VIndex u) {
+      for (int i = 0; i < (int)domain[u].size(); i++) {
+        if (!alive[u][i] || checkNeighborhood(G1, G2, u, domain[u][i])) continue;
+        if (!removeCandidate(u, i)) return false;
+        if (!queued[u]) queued[u] = 1, queue.push_back(u);
+      }
+      return true;
+    };
+    // the candidates of u depend on the domains of its neighbors only
+    while (!queue.empty()) {
+      VIndex w = queue.back();
+      queue.pop_back();
+      queued[w] = 0;
+      for (auto u: G1.succ(w)) if (!filter(u)) return false;
+      for (auto u: G1.pred(w)) if (!filter(u)) return false;
+    }
+    return true;
+  }
+
+  bool propagate(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
+    changed.assign(1, n);
+    for (int i = 0; i < (int)domain[n].size(); i++) {
+      if (domain[n][i] != m && alive[n][i]) removeCandidate(n, i);
+    }
+    for (VIndex u = 0; u < vertex_count; u++) {
+      int i = u == n ? -1 : position(u, m);
+      if (i < 0 || !alive[u][i]) continue;
+      if (!removeCandidate(u, i)) return false;
+      changed.push_back(u);
+    }
+    return filterDomains(G1, G2, changed);
+  }
+
+  void genCandiPairSet(const Graph &G1, const Graph &G2, Frame &f) {
+    // the query vertex is fixed by the matching order; its partner must be a
+    // G2 neighbor of the partner of its anchor, which also puts it in the
+    // same terminal set, or any vertex of its domain for the root of a
+    // component
+    f.n = (*order)[core_len];
+    f.m = NULL_VIndex;
+    f.pos = 0;
+    VIndex parent = plan->parent[core_len];
+    if (parent == NULL_VIndex) {
+      f.row = domain[f.n].data();
+      f.end = domain[f.n].size();
+    } else {
+      VRange r = neighbors(G1, G2, f.n, Anchor{parent, plan->parent_label[core_len],
+                                               plan->parent_succ[core_len] != 0});
+      f.row = r.begin();
+      f.end = r.size();
+      auto &backward = plan->backward[core_len];
+      if (backward.empty() || f.end < INTERSECT_MIN) return;
+      vector<VIndex> &list = candidate[core_len];
+      list.resize(f.end);
+      for (size_t i = 0; i < backward.size() && f.end; i++) {
+        VRange b = neighbors(G1, G2, f.n, backward[i]);
+        f.end = intersectSorted(f.row, f.end, b.begin(), b.size(), list.data());
+        f.row = list.data();
+      }
+    }
+  }
+
+  // the G2 neighbors of the partner of a that n may be paired with, sorted
+  VRange neighbors(const Graph &G1, const Graph &G2, VIndex n, const Anchor &a) const {
+    return a.succ ? G2.succWithLabel(core_1[a.vertex], G1.vertex[n], a.label) :
+                    G2.predWithLabel(core_1[a.vertex], G1.vertex[n], a.label);
+  }
+
+  bool nextCandidate(const Graph &G1, const Graph &G2, Frame &f, VIndex &m) {
+    bool root = plan->parent[core_len] == NULL_VIndex;
+    while (f.pos < f.end) {
+      m = f.row[f.pos++];
+      if (work.coreOf(m) != NULL_VIndex) continue;
+      if (root ? !alive[f.n][f.pos - 1] :
+          plan->propagate ? !admissible(f.n, m) : !compatible(G1, G2, f.n, m)) continue;
+      return true;
+    }
+    return false;
+  }
+
+  bool tag(vector<int> &terminal, int &len, VIndex vid) {
+    if (terminal[vid]) return false;
+    terminal[vid] = core_len;
+    len++;
+    return true;
+  }
+
+  bool untag(vector<int> &terminal, int &len, VIndex vid) {
+    if (terminal[vid] != core_len) return false;
+    terminal[vid] = 0;
+    len--;
+    return true;
+  }
+
+  void tag2(vector<int> &terminal, int &len, VIndex vid) {
+    work.touch(vid);
+    tag(terminal, len, vid);
+  }
+
+  void mark(uint64_t *mask, VIndex vid) {
+    if (W) mask[vid >> 6] |= 1ULL << (vid & 63);
+  }
+
+  void unmark(uint64_t *mask, VIndex vid) {
+    if (W) mask[vid >> 6] &= ~(1ULL << (vid & 63));
+  }
+
+  void addNewPair(VIndex n, VIndex m, VRange pred1, VRange pred2,
+                  VRange succ1, VRange succ2) {
+    core_len++;
+    core_1[n] = m;
+    work.touch(m);
+    work.core[m] = n;
+    mark(core_1_mask, n);
+    if (tag(in_1, in_1_len, n)) mark(in_1_mask, n);
+    if (tag(out_1, out_1_len, n)) mark(out_1_mask, n);
+    tag2(work.in, in_2_len, m);
+    tag2(work.out, out_2_len, m);
+    for (auto u: pred1) if (tag(in_1, in_1_len, u)) mark(in_1_mask, u);
+    for (auto u: pred2) tag2(work.in, in_2_len, u);
+    for (auto u: succ1) if (tag(out_1, out_1_len, u)) mark(out_1_mask, u);
+    for (auto u: succ2) tag2(work.out, out_2_len, u);
+  }
+
+  // every target vertex backTrack visits was touched by the matching addNewPair
+  void backTrack(VIndex n, VIndex m, VRange pred1, VRange pred2,
+                 VRange succ1, VRange succ2) {
+    if (untag(in_1, in_1_len, n)) unmark(in_1_mask, n);
+    if (untag(out_1, out_1_len, n)) unmark(out_1_mask, n);
+    untag(work.in, in_2_len, m);
+    untag(work.out, out_2_len, m);
+    for (auto u: pred1) if (untag(in_1, in_1_len, u)) unmark(in_1_mask, u);
+    for (auto u: pred2) untag(work.in, in_2_len, u);
+    for (auto u: succ1) if (untag(out_1, out_1_len, u)) unmark(out_1_mask, u);
+    for (auto u: succ2) untag(work.out, out_2_len, u);
+    unmark(core_1_mask, n);
+    core_1[n] = NULL_VIndex;
+    work.core[m] = NULL_VIndex;
+    core_len--;
+  }
+
+  bool checkPredRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
+    for (EIndex eid = G1.out_offset[n]; eid < G1.out_offset[n + 1]; eid++) {
+      VIndex map_vid = core_1[G1.out_adj[eid]];
+      if (map_vid == NULL_VIndex) continue;
+      // wehter there is an edge m -> map_vid has the same label as n -> vid
+      if (!G2.hasEdge(m, map_vid, G1.out_label[eid])) return false;
+    }
+    if (!Policy::induced) return true;
+    for (auto v2: G2.pred(m)) {
+      VIndex v1 = work.coreOf(v2);
+      if (v1 == NULL_VIndex) continue;
+      if (G1.edgeLabel(v1, n) == NULL_ELabel) return false;
+    }
+    return true;
+  }
+
+  bool checkSuccRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
+    for (EIndex eid = G1.in_offset[n]; eid < G1.in_offset[n + 1]; eid++) {
+      VIndex map_vid = core_1[G1.in_adj[eid]];
+      if (map_vid == NULL_VIndex) continue;
+      // wehter there is an edge map_vid -> m has the same label as vid -> n
+      if (!G2.hasEdge(map_vid, m, G1.in_label[eid])) return false;
+    }
+    if (!Policy::induced) return true;
+    for (auto v2: G2.succ(m)) {
+      VIndex v1 = work.coreOf(v2);
+      if (v1 == NULL_VIndex) continue;
+      if (G1.edgeLabel(n, v1) == NULL_ELabel) return false;
+    }
+    return true;
+  }
+
+  int terminal_size(const vector<int> &terminal, VRange r) {
+    return count_if(r.begin(), r.end(), [&](VIndex k) {
+      return terminal[k] && core_1[k] == NULL_VIndex;
+    });
+  }
+
+  int terminal_size_2(const vector<int> &terminal, VRange r) {
+    return count_if(r.begin(), r.end(), [&](VIndex k) {
+      return work.fresh(k) && terminal[k] && work.core[k] == NULL_VIndex;
+    });
+  }
+
+  const uint64_t *succRow(VIndex n) const { return plan->succ_mask.data() + n * W; }
+  const uint64_t *predRow(VIndex n) const { return plan->pred_mask.data() + n * W; }
+
+  int mask_terminal_size(const uint64_t *terminal, const uint64_t *row) const {
+    int card = 0;
+    for (int i = 0; i < W; i++) {
+      card += __builtin_popcountll(row[i] & terminal[i] & ~core_1_mask[i]);
+    }
+    return card;
+  }
+
+  int mask_new_size(const uint64_t *row) const {
+    int card = 0;
+    for (int i = 0; i < W; i++) {
+      uint64_t outside = Policy::induced ? ~(in_1_mask[i] | out_1_mask[i]) : ~core_1_mask[i];
+      card += __builtin_popcountll(row[i] & outside);
+    }
+    return card;
+  }
+
+  bool checkInRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
+    int card_succ_1 = W ? mask_terminal_size(in_1_mask, succRow(n)) :
+                          terminal_size(in_1, G1.succ(n));
+    int card_succ_2 = terminal_size_2(work.in, G2.succ(m));
+    if (!Policy::feasible(card_succ_1, card_succ_2)) return false;
+    int card_pred_1 = W ? mask_terminal_size(in_1_mask, predRow(n)) :
+                          terminal_size(in_1, G1.pred(n));
+    int card_pred_2 = terminal_size_2(work.in, G2.pred(m));
+    if (!Policy::feasible(card_pred_1, card_pred_2)) return false;
+    return true;
+  }
+
+  bool checkOutRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
+    int card_succ_1 = W ? mask_terminal_size(out_1_mask, succRow(n)) :
+                          terminal_size(out_1, G1.succ(n));
+    int card_succ_2 = terminal_size_2(work.out, G2.succ(m));
+    if (!Policy::feasible(card_succ_1, card_succ_2)) return false;
+    int card_pred_1 = W ? mask_terminal_size(out_1_mask, predRow(n)) :
+                          terminal_size(out_1, G1.pred(n));
+    int card_pred_2 = terminal_size_2(work.out, G2.pred(m));
+    if (!Policy::feasible(card_pred_1, card_pred_2)) return false;
+    return true;
+  }
+
+  int new_size(VRange r) {
+    // matched vertices carry both tags, so untagged means outside M(s) + T(s)
+    if (Policy::induced) {
+      return count_if(r.begin(), r.end(), [&](VIndex k) { return !in_1[k] && !out_1[k]; });
+    }
+    return count_if(r.begin(), r.end(), [&](VIndex k) { return core_1[k] == NULL_VIndex; });
+  }
+
+  int new_size_2(VRange r) {
+    if (Policy::induced) {
+      return count_if(r.begin(), r.end(), [&](VIndex k) {
+        return !work.fresh(k) || (!work.in[k] && !work.out[k]);
+      });
+    }
+    return count_if(r.begin(), r.end(), [&](VIndex k) { return work.coreOf(k) == NULL_VIndex; });
+  }
+
+  bool checkNewRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
+    int card_pred_1 = W ? mask_new_size(predRow(n)) : new_size(G1.pred(n));
+    int card_pred_2 = new_size_2(G2.pred(m));
+    if (!Policy::feasible(card_pred_1, card_pred_2)) return false;
+    int card_succ_1 = W ? mask_new_size(succRow(n)) : new_size(G1.succ(n));
+    int card_succ_2 = new_size_2(G2.succ(m));
+    if (!Policy::feasible(card_succ_1, card_succ_2)) return false;
+    return true;
+  }
+
+  bool checkSynRules(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
+    return checkPredRule(G1, G2, n, m) && checkSuccRule(G1, G2, n, m) &&
+           checkInRule(G1, G2, n, m) && checkOutRule(G1, G2, n, m) &&
+           checkNewRule(G1, G2, n, m);
+  }
+
+  bool checkSemRules(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
+    // node attributes
+    if (G1.vertex[n] != G2.vertex[m]) return false;
+    // branch attributes
+    // move it to checkSuccRule and checkPredRule
+    return true;
+  }
+
+  void printMapping() {
+    printf("%s mapping relationship found:\n", Policy::name);
+    for (auto i = 0; i < vertex_count; i++) {
+      printf("%d %d\n", i, core_1[i]);
+    }
+  }
+};
+
+/*
+* Number of vertices carrying each label over a whole graph collection
+*/
+vector<int> countLabels(const GraphSet &G) {
+  vector<int> label_count;
+  for (auto &g: G) {
+    for (VIndex u = 0; u < g.vertex_count; u++) {
+      VLabel l = g.vertex[u];
+      if (l >= (int)label_count.size()) label_count.resize(l + 1, 0);
+      label_count[l]++;
+    }
+  }
+  return label_count;
+}
+
+/*
+* Static matching order of a query graph, in the spirit of VF2++ and RI
+*
+* Each connected component is traversed breadth-first from its most
+* selective vertex: the one whose label is rarest in the database, ties
+* broken by higher degree. Inside a BFS level, vertices are taken greedily
+* by the number of neighbors already in the order, then by degree, then by
+* label rarity, so every vertex after a component root is constrained by as
+* many matched neighbors as possible. The order is computed once per query
+* and shared by every search against the database.
+*/
+vector<VIndex> genMatchOrder(const Graph &G, const vector<int> &label_count) {
+  int count = G.vertex_count;
+  vector<VIndex> order;
+  vector<int> conn(count, 0);
+  vector<char> visited(count, 0);
+  auto freq = [&](VIndex u) {
+    VLabel l = G.vertex[u];
+    return l < (int)label_count.size() ? label_count[l] : 0;
+  };
+  auto degree = [&](VIndex u) { return G.succ(u).size() + G.pred(u).size(); };
+  while ((int)order.size() < count) {
+    VIndex root = NULL_VIndex;
+    for (VIndex u = 0; u < count; u++) {
+      if (visited[u]) continue;
+      if (root == NULL_VIndex || freq(u) < freq(root) ||
+          (freq(u) == freq(root) && degree(u) > degree(root))) root = u;
+    }
+    vector<VIndex> level(1, root), next;
+    visited[root] = 1;
+    while (!level.empty()) {
+      for (size_t k = 0; k < level.size(); k++) {
+        size_t best = k;
+        for (size_t i = k + 1; i < level.size(); i++) {
+          VIndex u = level[i], b = level[best];
+          if (conn[u] != conn[b]) {
+            if (conn[u] > conn[b]) best = i;
+          } else if (degree(u) != degree(b)) {
+            if (degree(u) > degree(b)) best = i;
+          } else if (freq(u) < freq(b)) {
+            best = i;
+          }
+        }
+        swap(level[k], level[best]);
+        VIndex u = level[k];
+        order.push_back(u);
+        for (auto w: G.succ(u)) conn[w]++;
+        for (auto w: G.pred(u)) conn[w]++;
+      }
+      next.clear();
+      for (auto u: level) {
+        for (auto w: G.succ(u)) if (!visited[w]) visited[w] = 1, next.push_back(w);
+        for (auto w: G.pred(u)) if (!visited[w]) visited[w] = 1, next.push_back(w);
+      }
+      level.swap(next);
+    }
+  }
+  return order;
+}
+
+/*
+* Build the QueryPlan of G: its matching order with the anchor of every
+* vertex and, for queries of at most MAX_MASK_WORDS * 64 vertices, its
+* adjacency masks
+*/
+QueryPlan makeQueryPlan(const Graph &G, const vector<int> &label_count) {
+  QueryPlan plan;
+  plan.order = genMatchOrder(G, label_count);
+  plan.propagate = false;
+  vector<int> position(G.vertex_count);
+  for (int d = 0; d < G.vertex_count; d++) position[plan.order[d]] = d;
+  plan.parent.assign(G.vertex_count, NULL_VIndex);
+  plan.parent_succ.assign(G.vertex_count, 0);
+  for (int d = 0; d < G.vertex_count; d++) {
+    VIndex n = plan.order[d];
+    for (auto p: G.pred(n)) {
+      if (position[p] < d) plan.parent[d] = p, plan.parent_succ[d] = 1;
+    }
+    for (auto p: G.succ(n)) {
+      if (position[p] < d && plan.parent[d] == NULL_VIndex) plan.parent[d] = p;
+    }
+  }
+  plan.parent_label.assign(G.vertex_count, NULL_ELabel);
+  plan.backward.assign(G.vertex_count, vector<Anchor>());
+  for (int d = 0; d < G.vertex_count; d++) {
+    VIndex n = plan.order[d], p = plan.parent[d];
+    if (p != NULL_VIndex) {
+      plan.parent_label[d] = plan.parent_succ[d] ? G.edgeLabel(p, n) : G.edgeLabel(n, p);
+    }
+    for (EIndex eid = G.in_offset[n]; eid < G.in_offset[n + 1]; eid++) {
+      VIndex w = G.in_adj[eid];
+      if (position[w] < d && !(w == p && plan.parent_succ[d])) {
+        plan.backward[d].push_back(Anchor{w, G.in_label[eid], true});
+      }
+    }
+    for (EIndex eid = G.out_offset[n]; eid < G.out_offset[n + 1]; eid++) {
+      VIndex w = G.out_adj[eid];
+      if (position[w] < d && !(w == p && !plan.parent_succ[d])) {
+        plan.backward[d].push_back(Anchor{w, G.out_label[eid], false});
+      }
+    }
+  }
+  int words = (G.vertex_count + 63) / 64;
+  plan.words = 1;
+  while (plan.words < words) plan.words *= 2;
+  if (plan.words > MAX_MASK_WORDS) plan.words = 0;
+  plan.succ_mask.assign(G.vertex_count * plan.words, 0);
+  plan.pred_mask.assign(G.vertex_count * plan.words, 0);
+  for (VIndex u = 0; u < G.vertex_count && plan.words; u++) {
+    for (auto v: G.succ(u)) {
+      plan.succ_mask[u * plan.words + (v >> 6)] |= 1ULL << (v & 63);
+      plan.pred_mask[v * plan.words + (u >> 6)] |= 1ULL << (u & 63);
+    }
+  }
+  return plan;
+}
+
+/*
+* Callback for complete mappings: mapping[u] is the G2 vertex paired with
+* query vertex u. Returning false stops the search.
+*/
+typedef function<bool(const vector<VIndex> &mapping)> Visitor;
+
+/*
+* What a search does with the mappings it finds, and when it gives up
+*
+* A search tree too large for one thread is split at `split_depth`: a first
+* search collects the partial mappings of that depth in `prefixes` instead
+* of expanding them, then every prefix is searched on its own with `start`
+* pointing at it, the subtrees sharing one count so that they all stop
+* once `limit` mappings were found between them.
+*
+* Attributes
+* ----------
+* visit: Visitor, called for every mapping; when empty the search only
+*        counts, and mappings are never handed out
+* limit: long long, stop after this many mappings, 0 for no limit
+* count: long long, mappings found so far
+* budget: long long, stop after adding this many pairs, 0 for no budget
+* nodes: long long, pairs added so far
+* exhausted: bool, whether the search ran out of budget, its count is then
+*            incomplete
+* shared: atomic, if not NULL, the count of all subtrees of a split search,
+*         compared against limit instead of count
+* split_depth: int, depth of the split, 0 if the search is not split
+* prefixes: vector, if not NULL, receives the partner of order[0 ..
+*           split_depth) of every state of depth split_depth
+* start: the partners of order[0 .. split_depth) to resume from, or NULL
+*/
+struct SearchControl {
+  const Visitor *visit;
+  long long limit;
+  long long count;
+  long long budget, nodes;
+  bool exhausted;
+  atomic<long long> *shared;
+  int split_depth;
+  vector<VIndex> *prefixes;
+  const VIndex *start;
+
+  SearchControl(long long _limit, const Visitor *_visit = NULL):
+    visit(_visit), limit(_limit), count(0), budget(0), nodes(0), exhausted(false),
+    shared(NULL), split_depth(0), prefixes(NULL), start(NULL) {}
+
+  // record a complete mapping, return true if the search has to stop
+  bool found(const vector<VIndex> &mapping) {
+    count++;
+    if (visit && *visit && !(*visit)(mapping)) return true;
+    long long total = shared ? ++*shared : count;
+    return limit && total >= limit;
+  }
+
+  // account for a pair added to the state, return true if the search has
+  // to stop: out of budget, or another subtree reached the limit
+  bool expand() {
+    if (budget && ++nodes > budget) return exhausted = true;
+    return shared && limit && shared->load(memory_order_relaxed) >= limit;
+  }
+};
+
+/*
+* Depth-first search over the states reachable from `state`
+*
+* The recursion of VF2 runs on the explicit stack state.frame, whose
+* cursors walk the candidate pairs of every depth in place, so nothing is
+* allocated once the search has started, but for the intersected candidate
+* lists of a depth growing to the longest row they meet. The state is back
+* at its initial depth when solve() returns, also when `control` stopped it
+* early. States of depth control.split_depth are handed to
+* control.prefixes, if set, instead of being expanded.
+*/
+template <class Policy, int W>
+void solve(const Graph &G1, const Graph &G2, State<Policy, W> &state, SearchControl &control) {
+  typedef typename State<Policy, W>::Frame Frame;
+  int base = state.core_len;
+  if (base == state.vertex_count) {
+    control.found(state.core_1);
+    return;
+  }
+  // Compute the set P(s) of the pairs candidate for inclusion in M(s)
+  state.genCandiPairSet(G1, G2, state.frame[base]);
+  int depth = base;
+  bool stop = false;
+  while (depth >= base) {
+    Frame &f = state.frame[depth];
+    VIndex n = f.n, m;
+    // Restore s by undoing the pair tried last at this depth
+    if (f.m != NULL_VIndex) {
+      state.backTrack(n, f.m, G1.pred(n), G2.pred(f.m), G1.succ(n), G2.succ(f.m));
+      state.restoreDomains(f.trail);
+      f.m = NULL_VIndex;
+    }
+    if (stop) {
+      depth--;
+      continue;
+    }
+    // Take the next p in P(s) for which the feasibility rules succeed
+    bool feasible = false;
+    while (state.nextCandidate(G1, G2, f, m)) {
+      if (state.checkSemRules(G1, G2, n, m) && state.checkSynRules(G1, G2, n, m)) {
+        feasible = true;
+        break;
+      }
+    }
+    if (!feasible) {
+      depth--;
+      continue;
+    }
+    // Compute the state s' obtained by adding p to M(s)
+    state.addNewPair(n, m, G1.pred(n), G2.pred(m), G1.succ(n), G2.succ(m));
+    f.m = m;
+    f.trail = state.trail.size();
+    if (control.expand()) {
+      stop = true;
+      continue;
+    }
+    // If M(s') covers all the nodes of G1 then output M(s')
+    if (state.core_len == state.vertex_count) {
+      // state.printMapping();
+      stop = control.found(state.core_1);
+      continue;
+    }
+    // s' is a dead end if propagation empties a domain
+    if (state.plan->propagate && !state.propagate(G1, G2, n, m)) continue;
+    if (control.prefixes && state.core_len == control.split_depth) {
+      for (int d = 0; d < state.core_len; d++) {
+        control.prefixes->push_back(state.core_1[(*state.order)[d]]);
+      }
+      continue;
+    }
+    depth++;
+    state.genCandiPairSet(G1, G2, state.frame[depth]);
+  }
+}
+
+template <class Policy, int W>
+void search(const Graph &G1, const Graph &G2, const QueryPlan &plan, TargetWorkspace &work,
+            SearchControl &control, const VRange *roots) {
+  State<Policy, W> state(plan, work, G2.vertex_count);
+  // a query vertex without any admissible partner rules the pair out
+  if (!state.initDomains(G1, G2, roots)) return;
+  if (plan.propagate) {
+    vector<VIndex> queue(plan.order);
+    if (!state.filterDomains(G1, G2, queue)) return;
+  }
+  // replay the prefix of a split search, whose pairs were feasible when the
+  // prefix was collected, with the same domains
+  for (int d = 0; control.start && d < control.split_depth; d++) {
+    VIndex n = plan.order[d], m = control.start[d];
+    state.addNewPair(n, m, G1.pred(n), G2.pred(m), G1.succ(n), G2.succ(m));
+    if (plan.propagate && !state.propagate(G1, G2, n, m)) return;
+  }
+  solve(G1, G2, state, control);
+}
+
+/*
+* List the domains of G1 in G2 as initDomains does, once for a series of
+* searches of G1 in G2 (see TargetWorkspace::domain). Returns false if
+* some query vertex has no admissible partner, so that no search can
+* succeed. `work` is only used while listing.
+*/
+template <class Policy>
+bool listDomains(const Graph &G1, const Graph &G2, const QueryPlan &plan, TargetWorkspace &work,
+                 vector<vector<VIndex>> &domain) {
+  const vector<vector<VIndex>> *shared = work.domain;
+  work.domain = NULL;
+  State<Policy, 0> state(plan, work, G2.vertex_count);
+  bool found = state.initDomains(G1, G2);
+  work.domain = shared;
+  domain.swap(state.domain);
+  return found;
+}
+
+bool listDomains(MatchMode mode, const Graph &G1, const Graph &G2, const QueryPlan &plan,
+                 TargetWorkspace &work, vector<vector<VIndex>> &domain) {
+  switch (mode) {
+    case ISOMORPHISM: return listDomains<Isomorphism>(G1, G2, plan, work, domain);
+    case INDUCED_SUBGRAPH: return listDomains<InducedSubgraph>(G1, G2, plan, work, domain);
+    default: return listDomains<Monomorphism>(G1, G2, plan, work, domain);
+  }
+}
+
+/*
+* Search the mappings of G1 to G2 under the semantics of Policy, as
+* `control` directs. The target side of the search lives in `work`, or in a
+* workspace of the calling thread if it is NULL. If `roots` is given, only
+* the mappings that pair the first vertex of the matching order with one of
+* them are searched.
+*/
+template <class Policy>
+void runSearch(const Graph &G1, const Graph &G2, const QueryPlan &plan, SearchControl &control,
+               TargetWorkspace *work = NULL, const VRange *roots = NULL) {
+  static thread_local TargetWorkspace thread_work;
+  if (!work) work = &thread_work;
+  if (!Policy::feasible(G1.vertex_count, G2.vertex_count)) return;
+  if (!Policy::feasible(G1.edge_count, G2.edge_count)) return;
+  if (Policy::mode == ISOMORPHISM && G1.signature != G2.signature) return;
+  switch (plan.words) {
+    case 1: search<Policy, 1>(G1, G2, plan, *work, control, roots); break;
+    case 2: search<Policy, 2>(G1, G2, plan, *work, control, roots); break;
+    case 4: search<Policy, 4>(G1, G2, plan, *work, control, roots); break;
+    case 8: search<Policy, 8>(G1, G2, plan, *work, control, roots); break;
+    default: search<Policy, 0>(G1, G2, plan, *work, control, roots); break;
+  }
+}
+
+void runSearch(MatchMode mode, const Graph &G1, const Graph &G2, const QueryPlan &plan,
+               SearchControl &control, TargetWorkspace *work = NULL, const VRange *roots = NULL) {
+  switch (mode) {
+    case ISOMORPHISM: return runSearch<Isomorphism>(G1, G2, plan, control, work, roots);
+    case INDUCED_SUBGRAPH: return runSearch<InducedSubgraph>(G1, G2, plan, control, work, roots);
+    default: return runSearch<Monomorphism>(G1, G2, plan, control, work, roots);
+  }
+}
+
+/*
+* Find the mappings of G1 to G2 under the semantics of Policy, at most
+* `limit` of them if limit > 0. Every mapping is passed to `visit`, if given.
+* `work` and `roots` are as for runSearch. Returns the number of mappings
+* found.
+*/
+template <class Policy>
+long long findMappings(const Graph &G1, const Graph &G2, const QueryPlan &plan,
+                       long long limit, const Visitor &visit = Visitor(),
+                       TargetWorkspace *work = NULL, const VRange *roots = NULL) {
+  SearchControl control(limit, &visit);
+  runSearch<Policy>(G1, G2, plan, control, work, roots);
+  return control.count;
+}
+
+long long findMappings(MatchMode mode, const Graph &G1, const Graph &G2, const QueryPlan &plan,
+                       long long limit, const Visitor &visit = Visitor(),
+                       TargetWorkspace *work = NULL, const VRange *roots = NULL) {
+  switch (mode) {
+    case ISOMORPHISM: return findMappings<Isomorphism>(G1, G2, plan, limit, visit, work, roots);
+    case INDUCED_SUBGRAPH:
+      return findMappings<InducedSubgraph>(G1, G2, plan, limit, visit, work, roots);
+    default: return findMappings<Monomorphism>(G1, G2, plan, limit, visit, work, roots);
+  }
+}
+
+bool isomorphism(const Graph &G1, const Graph &G2, const QueryPlan &plan) {
+  return findMappings<Isomorphism>(G1, G2, plan, 1) > 0;
+}
+
+bool subisomorphism(const Graph &G1, const Graph &G2, const QueryPlan &plan) {
+  return findMappings<InducedSubgraph>(G1, G2, plan, 1) > 0;
+}
+
+bool monomorphism(const Graph &G1, const Graph &G2, const QueryPlan &plan) {
+  return findMappings<Monomorphism>(G1, G2, plan, 1) > 0;
+}
+
+/*
+* Label histogram pre-filter over a whole database
+*
+* Every graph is summarized by feature counts: its vertex and edge counts,
+* the number of vertices with each label, of edges with each label and of
+* edges with each (source label, edge label, target label) triple. An
+* embedding of G1 into G2 maps each of these to a distinct one of G2, so G2
+* can only contain G1 if it has at least as many of every feature, and only
+* be isomorphic to it if the counts are equal. Checking the features G1 has
+* is enough in both cases, since the totals are features too.
+*
+* Counts are stored feature-major, column[f][g] for database graph g, so
+* filtering a query is a few tight loops over the whole database. For
+* isomorphism the color refinement signatures of the graphs must match as
+* well, and they are compared first.
+*
+* Attributes
+* ----------
+* graph_count: int, number of database graphs
+* feature: map, feature key -> column index
+* column: vector, count of each feature in each database graph
+* signature: vector, the signature of each database graph
+*
+* Methods
+* -------
+* histogram: sorted (feature key, count) list of a graph
+* build: compute the columns of a database
+* candidates: mask of the database graphs that pass the filter for G1
+*/
+struct LabelFilter {
+  typedef array<int, 4> Key;
+  enum { VERTEX_TOTAL, EDGE_TOTAL, VERTEX_FEATURE, EDGE_FEATURE, TRIPLE_FEATURE };
+
+  int graph_count;
+  map<Key, int> feature;
+  vector<vector<int32_t>> column;
+  vector<uint64_t> signature;
+
+  static vector<pair<Key, int>> histogram(const Graph &G) {
+    vector<Key> keys;
+    keys.push_back(Key{{VERTEX_TOTAL, 0, 0, 0}});
+    for (VIndex u = 0; u < G.vertex_count; u++) {
+      keys.push_back(Key{{VERTEX_FEATURE, G.vertex[u], 0, 0}});
+      for (EIndex eid = G.out_offset[u]; eid < G.out_offset[u + 1]; eid++) {
+        keys.push_back(Key{{EDGE_TOTAL, 0, 0, 0}});
+        keys.push_back(Key{{EDGE_FEATURE, G.out_label[eid], 0, 0}});
+        keys.push_back(Key{{TRIPLE_FEATURE, G.vertex[u], G.out_label[eid],
+                            G.vertex[G.out_adj[eid]]}});
+      }
+    }
+    sort(keys.begin(), keys.end());
+    vector<pair<Key, int>> hist;
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (i == 0 || keys[i] != keys[i - 1]) hist.push_back(make_pair(keys[i], 0));
+      hist.back().second++;
+    }
+    return hist;
+  }
+
+  void build(const GraphSet &database) {
+    graph_count = database.size();
+    feature.clear();
+    column.clear();
+    signature.resize(graph_count);
+    for (int g = 0; g < graph_count; g++) {
+      signature[g] = database[g].signature;
+      for (auto &h: histogram(database[g])) {
+        auto it = feature.find(h.first);
+        if (it == feature.end()) {
+          it = feature.insert(make_pair(h.first, (int)column.size())).first;
+          column.push_back(vector<int32_t>(graph_count, 0));
+        }
+        column[it->second][g] = h.second;
+      }
+    }
+  }
+
+  vector<char> candidates(const Graph &G1, bool exact) const {
+    vector<char> pass(graph_count, 1);
+    if (exact) {
+      int survivors = 0;
+      for (int g = 0; g < graph_count; g++) survivors += pass[g] = signature[g] == G1.signature;
+      if (!survivors) return pass;
+    }
+    for (auto &h: histogram(G1)) {
+      auto it = feature.find(h.first);
+      if (it == feature.end()) return vector<char>(graph_count, 0);
+      const int32_t *count = column[it->second].data();
+      int32_t need = h.second;
+      char *p = pass.data();
+      if (exact) {
+        for (int g = 0; g < graph_count; g++) p[g] &= count[g] == need;
+      } else {
+        for (int g = 0; g < graph_count; g++) p[g] &= count[g] >= need;
+      }
+    }
+    return pass;
+  }
+};
+
+/*
+* Canonical labeling of a labeled directed graph
+*
+* A search tree of ordered partitions, in the style of nauty. The root
+* partition groups the vertices by label, in label order, and every node is
+* refined until it is equitable: vertices of a cell are split, in a fixed
+* order, by the multiset of (direction, edge label, cell) of their
+* neighbors. A node whose partition is not discrete individualizes each
+* vertex of its first non-trivial cell in turn, placing it before the rest
+* of the cell, and refines again. Every leaf is a discrete partition, i.e. a
+* relabeling of the graph, and the canonical form is the smallest certificate
+* (vertex count, labels and sorted edge list in the new numbering) over all
+* leaves. All choices depend only on the partition, so isomorphic graphs
+* explore the same tree up to relabeling and end in the same form.
+*
+* Two leaves with the same certificate give an automorphism, which fixes
+* the vertices individualized above their deepest common ancestor. The
+* child of that ancestor being explored is then the image of the one that
+* holds the earlier leaf, already explored, so the search jumps back to the
+* ancestor at once. Every node keeps the orbits of the automorphisms fixing
+* its individualized vertices, merged in as they are found, and skips the
+* vertices of its cell in the orbit of one it has already explored, as
+* their subtrees are images of one another. An automorphism is kept only if
+* it merges orbits of the ancestor, i.e. as a generator of the group found.
+*
+* Attributes
+* ----------
+* G: Graph, the graph being labeled
+* best, best_order, best_fixed: smallest certificate so far, its leaf and
+*     the vertices individualized on the way to it
+* first_form, first_order, first_fixed: the same for the first leaf
+* automorphism: vector, generators found so far, as vertex maps
+* orbit: vector, union-find parents of the orbits of the node of each depth
+* applied: vector, the generators merged into orbit[depth] so far
+*
+* Methods
+* -------
+* refine: refine a partition until it is equitable
+* certificate: the certificate of a discrete partition
+* updateOrbits: merge the generators found since into the orbits of a node
+* addAutomorphism: record the automorphism of two leaves
+* explore: visit the subtree of a partition, return the depth the search
+*     resumes at
+* form: return the canonical form of G
+*/
+struct CanonicalLabeling {
+  const Graph &G;
+  vector<int32_t> best, first_form;
+  vector<VIndex> best_order, best_fixed, first_order, first_fixed;
+  vector<vector<VIndex>> automorphism;
+  vector<vector<VIndex>> orbit;
+  vector<size_t> applied;
+
+  CanonicalLabeling(const Graph &_G): G(_G) {}
+
+  // order lists the vertices cell by cell, cell[v] is the first position of
+  // the cell of v
+  void refine(vector<VIndex> &order, vector<int> &cell) {
+    int count = G.vertex_count;
+    vector<vector<uint64_t>> key(count);
+    while (true) {
+      for (VIndex u = 0; u < count; u++) {
+        key[u].clear();
+        for (EIndex eid = G.out_offset[u]; eid < G.out_offset[u + 1]; eid++) {
+          key[u].push_back((uint64_t)(uint32_t)G.out_label[eid] << 31 | cell[G.out_adj[eid]]);
+        }
+        for (EIndex eid = G.in_offset[u]; eid < G.in_offset[u + 1]; eid++) {
+          key[u].push_back(1ULL << 63 | (uint64_t)(uint32_t)G.in_label[eid] << 31 |
+                           cell[G.in_adj[eid]]);
+        }
+        sort(key[u].begin(), key[u].end());
+      }
+      bool split = false;
+      vector<int> next(cell);
+      for (int first = 0, last; first < count; first = last) {
+        last = first + 1;
+        while (last < count && cell[order[last]] == first) last++;
+        if (last - first == 1) continue;
+        stable_sort(order.begin() + first, order.begin() + last,
+                    [&](VIndex a, VIndex b) { return key[a] < key[b]; });
+        for (int i = first + 1; i < last; i++) {
+          if (key[order[i]] != key[order[i - 1]]) split = true;
+          next[order[i]] = key[order[i]] == key[order[i - 1]] ? next[order[i - 1]] : i;
+        }
+      }
+      cell.swap(next);
+      if (!split) return;
+    }
+  }
+
+  vector<int32_t> certificate(const vector<VIndex> &order) {
+    int count = G.vertex_count;
+    vector<int> position(count);
+    for (int i = 0; i < count; i++) position[order[i]] = i;
+    vector<array<int32_t, 3>> edges;
+    for (VIndex u = 0; u < count; u++) {
+      for (EIndex eid = G.out_offset[u]; eid < G.out_offset[u + 1]; eid++) {
+        edges.push_back(array<int32_t, 3>{{position[u], position[G.out_adj[eid]],
+                                           G.out_label[eid]}});
+      }
+    }
+    sort(edges.begin(), edges.end());
+    vector<int32_t> form(1, count);
+    for (auto u: order) form.push_back(G.vertex[u]);
+    for (auto &e: edges) form.insert(form.end(), e.begin(), e.end());
+    return form;
+  }
+
+  static VIndex findRoot(vector<VIndex> &parent, VIndex v) {
+    while (parent[v] != v) v = parent[v] = parent[parent[v]];
+    return v;
+  }
+
+  // merge gamma into the orbits of `depth`, return the number of merges
+  int mergeOrbits(int depth, const vector<VIndex> &gamma) {
+    vector<VIndex> &parent = orbit[depth];
+    int merged = 0;
+    for (VIndex u = 0; u < (VIndex)gamma.size(); u++) {
+      VIndex a = findRoot(parent, u), b = findRoot(parent, gamma[u]);
+      if (a == b) continue;
+      parent[a] = b;
+      merged++;
+    }
+    return merged;
+  }
+
+  // the orbits of the node of `depth`, which individualized fixed[0 .. depth)
+  void updateOrbits(int depth, const vector<VIndex> &fixed) {
+    for (; applied[depth] < automorphism.size(); applied[depth]++) {
+      const vector<VIndex> &gamma = automorphism[applied[depth]];
+      bool fixes = true;
+      for (int i = 0; i < depth && fixes; i++) fixes = gamma[fixed[i]] == fixed[i];
+      if (fixes) mergeOrbits(depth, gamma);
+    }
+  }
+
+  // gamma fixes fixed[0 .. depth), the node it jumps back to
+  void addAutomorphism(const vector<VIndex> &gamma, int depth, const vector<VIndex> &fixed) {
+    updateOrbits(depth, fixed);
+    if (!mergeOrbits(depth, gamma)) return;
+    automorphism.push_back(gamma);
+    applied[depth] = automorphism.size();
+  }
+
+  int explore(vector<VIndex> &order, vector<int> &cell, vector<VIndex> &fixed) {
+    int count = G.vertex_count, depth = fixed.size();
+    refine(order, cell);
+    int begin = 0;
+    while (begin < count && (begin + 1 == count || cell[order[begin + 1]] != begin)) begin++;
+    if (begin == count) {
+      vector<int32_t> form = certificate(order);
+      if (first_form.empty()) {
+        first_form = best = form;
+        first_order = best_order = order;
+        first_fixed = best_fixed = fixed;
+        return depth;
+      }
+      const vector<VIndex> *leaf_order, *leaf_fixed;
+      if (form == first_form) {
+        leaf_order = &first_order, leaf_fixed = &first_fixed;
+      } else if (form == best) {
+        leaf_order = &best_order, leaf_fixed = &best_fixed;
+      } else {
+        if (form < best) best.swap(form), best_order = order, best_fixed = fixed;
+        return depth;
+      }
+      vector<VIndex> gamma(count);
+      for (int i = 0; i < count; i++) gamma[order[i]] = (*leaf_order)[i];
+      int common = 0;
+      while (common < depth && fixed[common] == (*leaf_fixed)[common]) common++;
+      addAutomorphism(gamma, common, fixed);
+      return common;
+    }
+    int end = begin + 1;
+    while (end < count && cell[order[end]] == begin) end++;
+    if ((int)orbit.size() <= depth) orbit.resize(depth + 1), applied.resize(depth + 1);
+    orbit[depth].resize(count);
+    for (VIndex u = 0; u < count; u++) orbit[depth][u] = u;
+    applied[depth] = 0;
+    vector<VIndex> target(order.begin() + begin, order.begin() + end), done;
+    sort(target.begin(), target.end());
+    for (auto v: target) {
+      if (!done.empty()) {
+        updateOrbits(depth, fixed);
+        bool seen = false;
+        for (auto w: done) seen = seen || findRoot(orbit[depth], w) == findRoot(orbit[depth], v);
+        if (seen) continue;
+      }
+      done.push_back(v);
+      vector<VIndex> child_order(order);
+      vector<int> child_cell(cell);
+      // individualize v: it becomes the first cell, the rest of its cell follows
+      swap(child_order[begin], *find(child_order.begin() + begin, child_order.begin() + end, v));
+      for (int i = begin + 1; i < end; i++) child_cell[child_order[i]] = begin + 1;
+      fixed.push_back(v);
+      int resume = explore(child_order, child_cell, fixed);
+      fixed.pop_back();
+      if (resume < depth) return resume;
+    }
+    return depth;
+  }
+
+  vector<int32_t> form() {
+    int count = G.vertex_count;
+    vector<VIndex> order(count), fixed;
+    for (VIndex u = 0; u < count; u++) order[u] = u;
+    stable_sort(order.begin(), order.end(),
+                [&](VIndex a, VIndex b) { return G.vertex[a] < G.vertex[b]; });
+    vector<int> cell(count);
+    for (int i = 0; i < count; i++) {
+      bool same = i > 0 && G.vertex[order[i]] == G.vertex[order[i - 1]];
+      cell[order[i]] = same ? cell[order[i - 1]] : i;
+    }
+    best.clear();
+    first_form.clear();
+    automorphism.clear();
+    explore(order, cell, fixed);
+    if (count == 0) best.assign(1, 0);
+    return best;
+  }
+};
+
+/*
+* Hash index of the canonical forms of a database
+*
+* Graphs are isomorphic iff their canonical forms are equal, so an exact
+* isomorphism query is one canonical labeling and one lookup instead of a
+* search against every database graph.
+*
+* Attributes
+* ----------
+* form: vector, canonical form of each database graph
+* bucket: unordered_map, hash of a canonical form -> database graphs with it
+*
+* Methods
+* -------
+* hash: hash of a canonical form
+* build: label every database graph
+* lookup: the database graphs isomorphic to G1, or with canonical form
+*     `key`, in increasing order
+*/
+struct CanonicalIndex {
+  vector<vector<int32_t>> form;
+  unordered_map<uint64_t, vector<int>> bucket;
+
+  static uint64_t hash(const vector<int32_t> &form) {
+    uint64_t h = mixHash(form.size());
+    for (auto x: form) h = mixHash(h ^ (uint32_t)x);
+    return h;
+  }
+
+  void build(const GraphSet &database) {
+    form.resize(database.size());
+    bucket.clear();
+    for (size_t g = 0; g < database.size(); g++) {
+      form[g] = CanonicalLabeling(database[g]).form();
+      bucket[hash(form[g])].push_back(g);
+    }
+  }
+
+  vector<int> lookup(const Graph &G1) const {
+    return lookup(CanonicalLabeling(G1).form());
+  }
+
+  vector<int> lookup(const vector<int32_t> &key) const {
+    vector<int> match;
+    auto it = bucket.find(hash(key));
+    if (it == bucket.end()) return match;
+    for (auto g: it->second) if (form[g] == key) match.push_back(g);
+    return match;
+  }
+};
+
+/*
+* Whether a list of `length` items of `item_size` bytes, about to be read
+* from the current position of `fp`, fits in the `file_size` bytes of the
+* file. The index and cache loaders check every list length they read with
+* it, so a damaged file is rejected instead of sizing a vector from garbage.
+*/
+static bool fitsInFile(FILE *fp, int64_t file_size, int64_t length, size_t item_size) {
+  long position = ftell(fp);
+  return length >= 0 && position >= 0 &&
+         length <= (file_size - position) / (int64_t)item_size;
+}
+
+/*
+* The size in bytes of the file `fp`, which is left at its start
+*/
+static int64_t fileSize(FILE *fp) {
+  if (fseek(fp, 0, SEEK_END) != 0) return -1;
+  int64_t size = ftell(fp);
+  return fseek(fp, 0, SEEK_SET) == 0 ? size : -1;
+}
+
+/*
+* Inverted index of the label paths of a database
+*
+* A path feature is the label sequence of a simple path of at most
+* max_length edges: vertex labels alternating with edge labels, each edge
+* label marked with the direction the path walks it in. A path and its
+* reverse are the same feature, keyed by the smaller of the two sequences,
+* and every path is counted once from each end. An embedding maps distinct
+* paths of G1 to distinct paths of G2 with the same sequence, so G2 can only
+* contain G1 if it has at least as many occurrences of every feature of G1.
+* Features are identified by a hash of their sequence; colliding features
+* merely add up their counts, which keeps the test sound.
+*
+* Binary file layout: PathHeader, then for every feature its key, its
+* posting count and its (graph id, occurrences) postings, sorted by graph id.
+*
 * Attributes
 * ----------
-* vertex_count: int, number of vertices
-* edge_count: int, number of edges
-* vertex: vector, length = `vertex_count`, label of each vertex
-* edge: vector, length = `edge_count`, edges of graph
-* head_edge: vector, length = `vertex_count`, ead of linked list
-* pred: vector, length = `vertex_count`, predecessors of each vertex
-* succ: vector, length = `vertex_count`, successors of each vertex
+* max_length: int, longest path indexed, in edges
+* graph_count: int, number of database graphs
+* db_version: uint64, GraphSet::version() of the indexed database
+* feature: unordered_map, feature key -> posting list index
+* posting: vector, (graph id, occurrences) of each feature
 *
 * Methods
 * -------
-* addVertex: add a vertex whose label is `label`
-* addEdge: add an edge from `u` to 'v', and its label is `label`
-* initial: initialize a graph
-* printGraphInfo: print graph structure
+* histogram: sorted (feature key, occurrences) list of a graph
+* build: enumerate the paths of every database graph
+* save: write the index to a file
+* load: read an index written by save, false if `path` is not one or was
+*     built for another database version or path length
+* candidates: the database graphs that contain all path features of G1
 */
-struct Graph {
-  int edge_count, vertex_count;
-  vector<VLabel> vertex;
-  vector<EIndex> head_edge;
-  vector<EIndex> rev_head_edge;
-  vector<Edge> edge;
-  vector<set<VIndex>> pred;
-  vector<set<VIndex>> succ;
+const char PATH_MAGIC[8] = {'V', 'F', '2', 'P', 'I', 'D', 'X', '\0'};
+const int PATH_VERSION = 3;
+
+struct PathHeader {
+  char magic[8];
+  int32_t version;
+  int32_t max_length;
+  int64_t graph_count;
+  int64_t feature_count;
+  uint64_t db_version;
+};
+
+struct PathIndex {
+  int max_length;
+  int graph_count;
+  uint64_t db_version;
+  unordered_map<uint64_t, int> feature;
+  vector<vector<pair<int32_t, int32_t>>> posting;
+
+  PathIndex(): max_length(0), graph_count(0), db_version(0) {}
+
+  static vector<pair<uint64_t, int>> histogram(const Graph &G, int max_length) {
+    vector<uint64_t> keys;
+    vector<int32_t> walk, reverse;
+    vector<char> on_path(G.vertex_count, 0);
+    auto record = [&]() {
+      // the reverse walk has the vertex labels in reverse order and every
+      // edge walked in the opposite direction
+      reverse.assign(walk.rbegin(), walk.rend());
+      for (size_t i = 1; i < reverse.size(); i += 2) reverse[i] ^= 1;
+      const vector<int32_t> &key = walk < reverse ? walk : reverse;
+      uint64_t h = mixHash(key.size());
+      for (auto x: key) h = mixHash(h ^ (uint32_t)x);
+      keys.push_back(h);
+    };
+    function<void(VIndex, int)> extend = [&](VIndex u, int length) {
+      record();
+      if (length == max_length) return;
+      on_path[u] = 1;
+      for (int dir = 0; dir < 2; dir++) {
+        EIndex first = dir ? G.in_offset[u] : G.out_offset[u];
+        EIndex last = dir ? G.in_offset[u + 1] : G.out_offset[u + 1];
+        for (EIndex eid = first; eid < last; eid++) {
+          VIndex v = dir ? G.in_adj[eid] : G.out_adj[eid];
+          if (on_path[v]) continue;
+          walk.push_back((dir ? G.in_label[eid] : G.out_label[eid]) * 2 + dir);
+          walk.push_back(G.vertex[v]);
+          extend(v, length + 1);
+          walk.pop_back();
+          walk.pop_back();
+        }
+      }
+      on_path[u] = 0;
+    };
+    for (VIndex u = 0; u < G.vertex_count; u++) {
+      walk.assign(1, G.vertex[u]);
+      extend(u, 0);
+    }
+    sort(keys.begin(), keys.end());
+    vector<pair<uint64_t, int>> hist;
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (i == 0 || keys[i] != keys[i - 1]) hist.push_back(make_pair(keys[i], 0));
+      hist.back().second++;
+    }
+    return hist;
+  }
 
-  void addVertex(int label) {
-    vertex.push_back(label);
-    head_edge.push_back(NULL_EIndex);
-    rev_head_edge.push_back(NULL_EIndex);
-    pred.push_back(NULL_VERTEX_SET);
-    succ.push_back(NULL_VERTEX_SET);
-    vertex_count++;
+  void build(const GraphSet &database, int _max_length) {
+    max_length = _max_length;
+    graph_count = database.size();
+    db_version = database.version();
+    feature.clear();
+    posting.clear();
+    for (int g = 0; g < graph_count; g++) {
+      for (auto &h: histogram(database[g], max_length)) {
+        auto it = feature.find(h.first);
+        if (it == feature.end()) {
+          it = feature.insert(make_pair(h.first, (int)posting.size())).first;
+          posting.push_back(vector<pair<int32_t, int32_t>>());
+        }
+        posting[it->second].push_back(make_pair(g, h.second));
+      }
+    }
   }
 
-  void addEdge(int u, int v, int label) {
-    edge.push_back(Edge(u, v, label, head_edge[u], rev_head_edge[v]));
-    head_edge[u] = edge_count;
-    rev_head_edge[v] = edge_count++;
-    pred[v].insert(u);
-    succ[u].insert(v);
+  bool save(const char *path) const {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+    PathHeader header;
+    memcpy(header.magic, PATH_MAGIC, sizeof(PATH_MAGIC));
+    header.version = PATH_VERSION;
+    header.max_length = max_length;
+    header.graph_count = graph_count;
+    header.feature_count = feature.size();
+    header.db_version = db_version;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (auto it = feature.begin(); it != feature.end() && ok; ++it) {
+      const vector<pair<int32_t, int32_t>> &list = posting[it->second];
+      int64_t length = list.size();
+      ok = fwrite(&it->first, sizeof(it->first), 1, fp) == 1 &&
+           fwrite(&length, sizeof(length), 1, fp) == 1 &&
+           fwrite(list.data(), sizeof(list[0]), length, fp) == (size_t)length;
+    }
+    return fclose(fp) == 0 && ok;
   }
 
-  void initial() {
-    vertex_count = edge_count = 0;
-    vertex.clear();
-    edge.clear();
-    head_edge.clear();
-    rev_head_edge.clear();
-    pred.clear();
-    succ.clear();
+  bool load(const char *path, uint64_t _db_version, int _max_length) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+    int64_t file_size = fileSize(fp);
+    PathHeader header;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+              memcmp(header.magic, PATH_MAGIC, sizeof(PATH_MAGIC)) == 0 &&
+              header.version == PATH_VERSION && header.db_version == _db_version &&
+              header.max_length == _max_length;
+    feature.clear();
+    posting.clear();
+    for (int64_t f = 0; f < header.feature_count && ok; f++) {
+      uint64_t key;
+      int64_t length;
+      ok = fread(&key, sizeof(key), 1, fp) == 1 && fread(&length, sizeof(length), 1, fp) == 1 &&
+           fitsInFile(fp, file_size, length, sizeof(pair<int32_t, int32_t>));
+      if (!ok) break;
+      feature[key] = posting.size();
+      posting.push_back(vector<pair<int32_t, int32_t>>(length));
+      ok = fread(posting.back().data(), sizeof(posting.back()[0]), length, fp) == (size_t)length;
+    }
+    fclose(fp);
+    if (!ok) {
+      feature.clear();
+      posting.clear();
+      return false;
+    }
+    max_length = header.max_length;
+    graph_count = header.graph_count;
+    db_version = header.db_version;
+    return true;
   }
 
-  void printGraphInfo() const {
-    printf("vertex count: %d\n", vertex_count);
-    printf("vertex label:\n");
-    for (auto v: vertex) printf("%d ", v);
-    puts("");
-    printf("vertex predecessors:\n");
-    int cnt = 0;
-    for (auto nodes: pred) {
-      printf("No.%d:", cnt++);
-      for (auto v: nodes) {
-        printf(" %d", v);
+  vector<int> candidates(const Graph &G1) const {
+    vector<const vector<pair<int32_t, int32_t>> *> list;
+    vector<int32_t> need;
+    for (auto &h: histogram(G1, max_length)) {
+      auto it = feature.find(h.first);
+      if (it == feature.end()) return vector<int>();
+      list.push_back(&posting[it->second]);
+      need.push_back(h.second);
+    }
+    vector<int> survivor;
+    if (list.empty()) {
+      for (int g = 0; g < graph_count; g++) survivor.push_back(g);
+      return survivor;
+    }
+    // walk the shortest posting list, probe the others by binary search
+    size_t shortest = 0;
+    for (size_t f = 1; f < list.size(); f++) {
+      if (list[f]->size() < list[shortest]->size()) shortest = f;
+    }
+    for (auto &p: *list[shortest]) {
+      if (p.second < need[shortest]) continue;
+      bool pass = true;
+      for (size_t f = 0; f < list.size() && pass; f++) {
+        auto it = lower_bound(list[f]->begin(), list[f]->end(), make_pair(p.first, 0));
+        pass = it != list[f]->end() && it->first == p.first && it->second >= need[f];
       }
-      puts("");
+      if (pass) survivor.push_back(p.first);
     }
-    printf("edge count: %d\n", edge_count);
-    puts("");
+    return survivor;
   }
 };
-vector<Graph> database, query;
-
-void readGraph(vector<Graph> &G, int total) {
-  Graph new_graph;
-  new_graph.initial();
-  char str[10000];
-  while (gets(str)) {
-    if (strlen(str) == 0) continue;
-    stringstream stream;
-    if (str[0] == 't') {
-      int gid;
-      stream << str + 4;
-      stream >> gid;
-      --total;
-      if (gid == 0) continue;
-      G.push_back(new_graph);
-      if (total == 0) break;
-      new_graph.initial();
-    } else if (str[0] == 'v') {
-      int vid, vlabel;
-      stream << str + 2;
-      stream >> vid >> vlabel;
-      new_graph.addVertex(vlabel);
-    } else if (str[0] == 'e') {
-      int uid, vid, elabel;
-      stream << str + 2;
-      stream >> uid >> vid >> elabel;
-      new_graph.addEdge(uid, vid, elabel);
-    }
-  }
-  printf("Total size: %d\n", G.size());
-}
 
 /*
-* Possible state
+* Index of frequent, discriminative fragments of a database, after gIndex
+*
+* Fragments are connected patterns of at most max_edges edges, grown one
+* edge at a time. The extensions of a fragment are read off its embeddings
+* in a sample of the graphs that contain it, which the VF2 matcher
+* enumerates, and an extension either closes a cycle between two fragment
+* vertices or hangs a new vertex off one. Children are told apart by their
+* canonical form, and VF2 monomorphism over the graphs containing all their
+* parents gives their support. Fragments contained in fewer than
+* min_support graphs are dropped, with all their extensions.
+*
+* A frequent fragment is indexed when it is discriminative: the graphs that
+* contain all of its nearest indexed ancestors number at least gamma times
+* the graphs that contain it. Single edges are always indexed. A graph
+* can only contain the query if it contains every indexed fragment the
+* query contains, so the candidates are the intersection of their posting
+* lists. Fragments are tested against the query ancestors first, and one is
+* skipped as soon as an ancestor is missing from the query.
+*
+* Binary file layout: FragmentHeader, then for every fragment, as int32:
+* its vertex count and labels, its edge count and (u, v, label) edges, its
+* ancestors, then its posting list, each list preceded by its length.
 *
 * Attributes
 * ----------
-* vertex_count: int, the number of vertexes in query graph
-* subisomorphism: bool, isomorphism or subgraph isomorphism,
-*                 different form of feasibility rules
-* in_1, in_2: set, the set of nodes, not yet in the partial mapping, that are
-*             the origin of edges ending into G1(s) and G2(s)
-* out_1, out_2: set, the set of nodes, not yet in the partial mapping, that are
-*             the destination of edges starting from G1(s) and G2(s)
-* M1, M2: set, the set of nodes in G1(s) and G2(s)
-* core_1, core_2: vector, length=vertex_count(G1 or G2), core_1[u] contains the
-*                 index of the node paired with u, if u is in M1(s),
-*                 or NULL_VIndex otherwise
+* graph_count: int, number of database graphs
+* db_version: uint64, GraphSet::version() of the indexed database
+* fragment: GraphSet, the indexed fragments, in order of size
+* plan: vector, QueryPlan of each fragment
+* ancestor: vector, the nearest indexed ancestors of each fragment
+* posting: vector, sorted ids of the database graphs containing a fragment
 *
 * Methods
 * -------
-* genCandiPairSet: computation of the candidate pairs set P(s)
-* addNewPair: add a mapping pair (n, m) to current state and update attributes
-* checkPredRule, checkSuccRule: check consistency of the partial solution M(s')
-*     obtained by adding the considered candidate pair(n, m) to current state
-* checkInRule, checkOutRule: pruning the search tree, perform a 1-look-ahead in
-*     the searching process
-* checkNewRule: pruning the search tree, a 2-look-ahead
-* set_intersection_size: int, return the size of intersection of two sets
-* genComplementary: set, return the complementary set of M1(s)(or M2(s)) and
-*     T1(s)(or T2(s))
-* checkSynRules: check all synatic feasibility rules
-* checkSemRules: check nodes attributes and edge attributes
+* build: mine and index the fragments of a database
+* save: write the index to a file
+* load: read an index written by save, false if `path` is not one or was
+*     built for another database version
+* candidates: the database graphs that contain all indexed fragments of G1
 */
-struct State {
-  int vertex_count;
-  bool subisomorphism;
-  set<VIndex> in_1, in_2, out_1, out_2;
-  set<VIndex> M1, M2;
-  vector<VIndex> core_1, core_2;
-
-  State(int _count, bool sub) {
-    vertex_count = _count;
-    subisomorphism = sub;
-    core_1.resize(_count);
-    fill(core_1.begin(), core_1.end(), NULL_VIndex);
-    core_2.resize(_count);
-    fill(core_2.begin(), core_2.end(), NULL_VIndex);
-    in_1.clear(), in_2.clear();
-    out_1.clear(), out_2.clear();
-    M1.clear(), M2.clear();
-  }
-
-  vector<pair<VIndex, VIndex>> genCandiPairSet() {
-    vector<pair<VIndex, VIndex>> P;
-    if (out_1.size() && out_2.size()) {
-      VIndex max_vid2 = -1;
-      for (auto vid2: out_2) max_vid2 = max(max_vid2, vid2);
-      for (auto vid1: out_1) {
-        P.push_back(make_pair(vid1, max_vid2));
-      }
-    } else if (in_1.size() && in_2.size()) {
-      VIndex max_vid2 = -1;
-      for (auto vid2: in_2) max_vid2 = max(max_vid2, vid2);
-      for (auto vid1: in_1) {
-        P.push_back(make_pair(vid1, max_vid2));
+const char FRAGMENT_MAGIC[8] = {'V', 'F', '2', 'F', 'I', 'D', 'X', '\0'};
+const int FRAGMENT_VERSION = 3;
+
+struct FragmentHeader {
+  char magic[8];
+  int32_t version;
+  int32_t max_edges;
+  int64_t graph_count;
+  int64_t fragment_count;
+  uint64_t db_version;
+};
+
+struct FragmentIndex {
+  int graph_count;
+  uint64_t db_version;
+  GraphSet fragment;
+  vector<QueryPlan> plan;
+  vector<vector<int>> ancestor;
+  vector<vector<int32_t>> posting;
+
+  FragmentIndex(): graph_count(0), db_version(0) {}
+
+  struct Pattern {
+    vector<VLabel> label;
+    vector<Edge> edge;
+    vector<int32_t> support;
+    vector<int> parent;
+    vector<int> ancestor;
+    int indexed;
+  };
+
+  static void addPattern(GraphSet &G, const Pattern &p) {
+    G.storage[VERTEX_LABEL].insert(G.storage[VERTEX_LABEL].end(), p.label.begin(), p.label.end());
+    vector<Edge> edge(p.edge);
+    G.addGraph(p.label.size(), edge);
+  }
+
+  void build(const GraphSet &database, const vector<int> &label_count, int max_edges,
+             double min_support, double gamma) {
+    graph_count = database.size();
+    db_version = database.version();
+    int threshold = max(1, (int)(min_support * graph_count));
+    vector<Pattern> pattern;
+    vector<int> level;
+    // single edges, counted directly
+    map<array<int, 3>, vector<int32_t>> triple;
+    for (int g = 0; g < graph_count; g++) {
+      const Graph &G = database[g];
+      set<array<int, 3>> found;
+      for (VIndex u = 0; u < G.vertex_count; u++) {
+        for (EIndex eid = G.out_offset[u]; eid < G.out_offset[u + 1]; eid++) {
+          VIndex v = G.out_adj[eid];
+          if (v != u) found.insert(array<int, 3>{{G.vertex[u], G.out_label[eid], G.vertex[v]}});
+        }
       }
-    } else {
-      VIndex max_vid2;
-      for (max_vid2 = vertex_count - 1; max_vid2 >= 0 && core_2[max_vid2] !=
-                                        NULL_VIndex; max_vid2--) {}
-      for (auto vid = 0; vid < vertex_count; vid++) {
-        if (core_1[vid] == NULL_VIndex) {
-          P.push_back(make_pair(vid, max_vid2));
+      for (auto &t: found) triple[t].push_back(g);
+    }
+    for (auto &t: triple) {
+      if ((int)t.second.size() < threshold) continue;
+      Pattern p;
+      p.label = {t.first[0], t.first[2]};
+      p.edge.push_back(Edge(0, 1, t.first[1]));
+      p.support = t.second;
+      p.indexed = 1;
+      level.push_back(pattern.size());
+      pattern.push_back(p);
+    }
+    for (int size = 1; size < max_edges && !level.empty(); size++) {
+      map<vector<int32_t>, int> child_of_form;
+      vector<int> next;
+      for (auto id: level) {
+        GraphSet parent_set;
+        addPattern(parent_set, pattern[id]);
+        parent_set.link();
+        const Graph &P = parent_set[0];
+        QueryPlan parent_plan = makeQueryPlan(P, label_count);
+        // extensions seen in the embeddings of a sample of its support
+        set<array<int, 4>> extension;
+        vector<int> inverse;
+        // a copy, as new children grow `pattern`
+        const vector<int32_t> support = pattern[id].support;
+        int stride = max<int>(1, support.size() / 64);
+        for (size_t k = 0; k < support.size(); k += stride) {
+          const Graph &G = database[support[k]];
+          inverse.assign(G.vertex_count, -1);
+          Visitor collect = [&](const vector<VIndex> &mapping) {
+            for (VIndex x = 0; x < P.vertex_count; x++) inverse[mapping[x]] = x;
+            for (VIndex x = 0; x < P.vertex_count; x++) {
+              VIndex u = mapping[x];
+              for (EIndex eid = G.out_offset[u]; eid < G.out_offset[u + 1]; eid++) {
+                VIndex w = G.out_adj[eid];
+                if (w == u) continue;
+                if (inverse[w] < 0) {
+                  extension.insert(array<int, 4>{{1, x, G.out_label[eid], G.vertex[w]}});
+                } else if (P.edgeLabel(x, inverse[w]) == NULL_ELabel) {
+                  extension.insert(array<int, 4>{{0, x, G.out_label[eid], inverse[w]}});
+                }
+              }
+              for (EIndex eid = G.in_offset[u]; eid < G.in_offset[u + 1]; eid++) {
+                VIndex w = G.in_adj[eid];
+                if (w != u && inverse[w] < 0) {
+                  extension.insert(array<int, 4>{{2, x, G.in_label[eid], G.vertex[w]}});
+                }
+              }
+            }
+            for (VIndex x = 0; x < P.vertex_count; x++) inverse[mapping[x]] = -1;
+            return true;
+          };
+          findMappings<Monomorphism>(P, G, parent_plan, 16, collect);
+        }
+        for (auto &e: extension) {
+          Pattern child;
+          child.indexed = 0;
+          child.label = pattern[id].label;
+          child.edge = pattern[id].edge;
+          if (e[0] == 0) {
+            child.edge.push_back(Edge(e[1], e[3], e[2]));
+          } else {
+            child.label.push_back(e[3]);
+            VIndex w = child.label.size() - 1;
+            child.edge.push_back(e[0] == 1 ? Edge(e[1], w, e[2]) : Edge(w, e[1], e[2]));
+          }
+          GraphSet child_set;
+          addPattern(child_set, child);
+          child_set.link();
+          vector<int32_t> form = CanonicalLabeling(child_set[0]).form();
+          auto it = child_of_form.find(form);
+          if (it == child_of_form.end()) {
+            it = child_of_form.insert(make_pair(form, (int)pattern.size())).first;
+            child.support = support;
+            pattern.push_back(child);
+            next.push_back(it->second);
+          }
+          Pattern &c = pattern[it->second];
+          if (find(c.parent.begin(), c.parent.end(), id) != c.parent.end()) continue;
+          c.parent.push_back(id);
+          c.support.resize(intersectSorted(c.support.data(), c.support.size(), support.data(),
+                                           support.size(), c.support.data()));
+        }
+      }
+      level.clear();
+      for (auto id: next) {
+        Pattern &c = pattern[id];
+        if ((int)c.support.size() < threshold) continue;
+        GraphSet child_set;
+        addPattern(child_set, c);
+        child_set.link();
+        QueryPlan child_plan = makeQueryPlan(child_set[0], label_count);
+        vector<int32_t> support;
+        for (auto g: c.support) {
+          if (monomorphism(child_set[0], database[g], child_plan)) support.push_back(g);
+        }
+        c.support.swap(support);
+        if ((int)c.support.size() < threshold) continue;
+        for (auto p: c.parent) {
+          const vector<int> &a = pattern[p].indexed ? vector<int>(1, p) : pattern[p].ancestor;
+          c.ancestor.insert(c.ancestor.end(), a.begin(), a.end());
         }
+        sort(c.ancestor.begin(), c.ancestor.end());
+        c.ancestor.erase(unique(c.ancestor.begin(), c.ancestor.end()), c.ancestor.end());
+        vector<int32_t> bound(pattern[c.ancestor[0]].support);
+        for (auto a: c.ancestor) {
+          const vector<int32_t> &other = pattern[a].support;
+          bound.resize(intersectSorted(bound.data(), bound.size(), other.data(), other.size(),
+                                       bound.data()));
+        }
+        c.indexed = bound.size() >= gamma * c.support.size();
+        level.push_back(id);
       }
     }
-    /*
-    puts("Candidate pair set");
-    for (auto p: P) {
-      printf("%d %d\n", p.first, p.second);
+    // keep the indexed fragments, ancestors renumbered
+    fragment.clear();
+    plan.clear();
+    ancestor.clear();
+    posting.clear();
+    vector<int> rank(pattern.size(), -1);
+    for (size_t id = 0; id < pattern.size(); id++) {
+      Pattern &p = pattern[id];
+      if (!p.indexed || (int)p.support.size() < threshold) continue;
+      rank[id] = posting.size();
+      addPattern(fragment, p);
+      ancestor.push_back(vector<int>());
+      for (auto a: p.ancestor) ancestor.back().push_back(rank[a]);
+      posting.push_back(p.support);
     }
-    */
-    return P;
+    fragment.link();
+    for (auto &F: fragment) plan.push_back(makeQueryPlan(F, label_count));
   }
 
-  void addNewPair(VIndex n, VIndex m, const set<VIndex> &pred1, const set<VIndex> &pred2,
-                  const set<VIndex> &succ1, const set<VIndex> &succ2) {
-    M1.insert(n);
-    M2.insert(m);
-    core_1[n] = m;
-    core_2[m] = n;
-    for (auto u: pred1) if (core_1[u] == NULL_VIndex) in_1.insert(u);
-    for (auto u: pred2) if (core_2[u] == NULL_VIndex) in_2.insert(u);
-    for (auto u: succ1) if (core_1[u] == NULL_VIndex) out_1.insert(u);
-    for (auto u: succ2) if (core_2[u] == NULL_VIndex) out_2.insert(u);
-    if (in_1.find(n) != in_1.end()) in_1.erase(n);
-    if (in_2.find(m) != in_2.end()) in_2.erase(m);
-    if (out_1.find(n) != out_1.end()) out_1.erase(n);
-    if (out_2.find(m) != out_2.end()) out_2.erase(m);
+  bool save(const char *path) const {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+    FragmentHeader header;
+    memcpy(header.magic, FRAGMENT_MAGIC, sizeof(FRAGMENT_MAGIC));
+    header.version = FRAGMENT_VERSION;
+    header.max_edges = 0;
+    for (auto &F: fragment) header.max_edges = max(header.max_edges, F.edge_count);
+    header.graph_count = graph_count;
+    header.fragment_count = fragment.size();
+    header.db_version = db_version;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    auto put = [&](const vector<int32_t> &list) {
+      int32_t length = list.size();
+      ok = ok && fwrite(&length, sizeof(length), 1, fp) == 1 &&
+           fwrite(list.data(), sizeof(int32_t), length, fp) == (size_t)length;
+    };
+    for (size_t f = 0; f < fragment.size(); f++) {
+      const Graph &F = fragment[f];
+      put(vector<int32_t>(F.vertex, F.vertex + F.vertex_count));
+      vector<int32_t> edge;
+      for (VIndex u = 0; u < F.vertex_count; u++) {
+        for (EIndex eid = F.out_offset[u]; eid < F.out_offset[u + 1]; eid++) {
+          edge.insert(edge.end(), {u, F.out_adj[eid], F.out_label[eid]});
+        }
+      }
+      put(edge);
+      put(vector<int32_t>(ancestor[f].begin(), ancestor[f].end()));
+      put(posting[f]);
+    }
+    return fclose(fp) == 0 && ok;
   }
 
-  bool checkPredRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
-    for (EIndex eid = G1.head_edge[n]; eid != NULL_EIndex; eid = G1.edge[eid].next) {
-      VIndex vid = G1.edge[eid].v;
-      VIndex map_vid = core_1[G1.edge[eid].v];
-      if (map_vid == NULL_VIndex) continue;
-      int label = G1.edge[eid].label;
-      // wehter there is an edge m -> map_vid has the same label as n -> vid
-      bool flag = 0;
-      for (EIndex eid2 = G2.head_edge[m]; eid2 != NULL_EIndex; eid2 = G2.edge[eid2].next) {
-        if (G2.edge[eid2].v == map_vid && G2.edge[eid2].label == label) {
-          flag = 1;
-          break;
-        }
+  bool load(const char *path, uint64_t _db_version, const vector<int> &label_count) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+    int64_t file_size = fileSize(fp);
+    FragmentHeader header;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+              memcmp(header.magic, FRAGMENT_MAGIC, sizeof(FRAGMENT_MAGIC)) == 0 &&
+              header.version == FRAGMENT_VERSION && header.db_version == _db_version;
+    auto get = [&](vector<int32_t> &list) {
+      int32_t length = 0;
+      ok = ok && fread(&length, sizeof(length), 1, fp) == 1 &&
+           fitsInFile(fp, file_size, length, sizeof(int32_t));
+      list.resize(ok ? length : 0);
+      ok = ok && fread(list.data(), sizeof(int32_t), length, fp) == (size_t)length;
+    };
+    fragment.clear();
+    plan.clear();
+    ancestor.clear();
+    posting.clear();
+    vector<int32_t> label, edge, list;
+    for (int64_t f = 0; f < header.fragment_count && ok; f++) {
+      get(label), get(edge), get(list);
+      ancestor.push_back(vector<int>(list.begin(), list.end()));
+      posting.push_back(vector<int32_t>());
+      get(posting.back());
+      if (!ok) break;
+      fragment.storage[VERTEX_LABEL].insert(fragment.storage[VERTEX_LABEL].end(),
+                                            label.begin(), label.end());
+      vector<Edge> edges;
+      for (size_t i = 0; i + 2 < edge.size(); i += 3) {
+        edges.push_back(Edge(edge[i], edge[i + 1], edge[i + 2]));
       }
-      if (!flag) return false;
+      fragment.addGraph(label.size(), edges);
     }
-    set<VIndex> new_pred;
-    set_intersection(M2.begin(), M2.end(), G2.pred[m].begin(), G2.pred[m].end(),
-                    inserter(new_pred, new_pred.begin()));
-    for (auto v2: new_pred) {
-      VIndex v1 = core_2[v2];
-      assert(v1 != NULL_VIndex);
-      if (G1.pred[n].find(v1) == G1.pred[n].end()) return false;
+    fclose(fp);
+    fragment.link();
+    if (!ok) {
+      fragment.clear();
+      ancestor.clear();
+      posting.clear();
+      return false;
     }
+    graph_count = header.graph_count;
+    db_version = header.db_version;
+    for (auto &F: fragment) plan.push_back(makeQueryPlan(F, label_count));
     return true;
   }
 
-  bool checkSuccRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
-    for (EIndex eid = G1.rev_head_edge[n]; eid != NULL_EIndex; eid = G1.edge[eid].prev) {
-      VIndex vid = G1.edge[eid].u;
-      VIndex map_vid = core_1[G1.edge[eid].u];
-      if (map_vid == NULL_VIndex) continue;
-      int label = G1.edge[eid].label;
-      // wehter there is an edge map_vid -> m has the same label as vid -> n
-      bool flag = 0;
-      for (EIndex eid2 = G2.rev_head_edge[m]; eid2 != NULL_EIndex; eid2 = G2.edge[eid2].prev) {
-        if (G2.edge[eid2].u == map_vid && G2.edge[eid2].label == label) {
-          flag = 1;
-          break;
-        }
+  vector<int> candidates(const Graph &G1) const {
+    vector<char> contained(fragment.size(), 0);
+    vector<int32_t> survivor;
+    bool first = true;
+    for (size_t f = 0; f < fragment.size(); f++) {
+      bool possible = true;
+      for (auto a: ancestor[f]) possible = possible && contained[a];
+      if (!possible || !monomorphism(fragment[f], G1, plan[f])) continue;
+      contained[f] = 1;
+      if (first) {
+        survivor = posting[f];
+        first = false;
+      } else {
+        survivor.resize(intersectSorted(survivor.data(), survivor.size(), posting[f].data(),
+                                        posting[f].size(), survivor.data()));
       }
-      if (!flag) return false;
     }
-    set<VIndex> new_succ;
-    set_intersection(M2.begin(), M2.end(), G2.succ[m].begin(), G2.succ[m].end(),
-                    inserter(new_succ, new_succ.begin()));
-    for (auto v2: new_succ) {
-      VIndex v1 = core_2[v2];
-      assert(v1 != NULL_VIndex);
-      if (G1.succ[n].find(v1) == G1.succ[n].end()) return false;
+    if (first) {
+      for (int g = 0; g < graph_count; g++) survivor.push_back(g);
     }
-    return true;
+    return vector<int>(survivor.begin(), survivor.end());
   }
+};
+
+/*
+* Cache of query results, keyed by canonical query form and matching mode
+*
+* Isomorphic queries have the same canonical form, so a repeated or
+* renumbered query is answered by one canonical labeling and one lookup.
+* An entry holds the ids of the matching database graphs, and the number
+* of database graphs that passed the pre-filters, with a key of the filters
+* in use (see main), so a hit is reported without filtering again. The cache
+* belongs to one database version (see GraphSet::version). It can be saved
+* to a file and reloaded, and a file written for another database version,
+* or in another format, is ignored.
+*
+* Binary file layout: CacheHeader, then for every entry, as int32: its
+* mode, filter key and survivor count, its canonical form and its graph
+* ids, each list preceded by its length.
+*
+* Attributes
+* ----------
+* db_version: uint64, the database version the entries belong to
+* entry: vector, the cached results
+* bucket: unordered_map, hash of (form, mode) -> entries with that hash
+*
+* Methods
+* -------
+* reset: drop all entries and attach the cache to a database version
+* find: the entry of (form, mode), NULL on a miss
+* insert: record the graph ids and survivors of (form, mode), replacing
+*     those of an existing entry
+* save: write the entries to a file
+* load: read the entries of a file written for the current version, none
+*     if it is damaged
+*/
+const char CACHE_MAGIC[8] = {'V', 'F', '2', 'Q', 'C', 'A', 'C', '\0'};
+const int CACHE_VERSION = 3;
+
+struct CacheHeader {
+  char magic[8];
+  int32_t version;
+  uint64_t db_version;
+  int64_t entry_count;
+};
 
-  int set_intersection_size(const set<VIndex> &a, const set<VIndex> &b) {
-    return count_if(a.begin(), a.end(), [&](int k) { return b.find(k) != b.end(); });
+struct ResultCache {
+  struct Entry {
+    int32_t mode;
+    int32_t filter, survivors;
+    vector<int32_t> form;
+    vector<int32_t> graph;
+  };
+
+  uint64_t db_version;
+  vector<Entry> entry;
+  unordered_map<uint64_t, vector<int>> bucket;
+
+  ResultCache(): db_version(0) {}
+
+  static uint64_t hash(const vector<int32_t> &form, MatchMode mode) {
+    return mixHash(CanonicalIndex::hash(form) ^ mode);
   }
 
-  bool checkInRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
-    int card_succ_1 = set_intersection_size(in_1, G1.succ[n]);
-    int card_succ_2 = set_intersection_size(in_2, G2.succ[m]);
-    if (!subisomorphism && card_succ_1 != card_succ_2) return false;
-    if (subisomorphism && card_succ_1 > card_succ_2) return false;
-    int card_pred_1 = set_intersection_size(in_1, G1.pred[n]);
-    int card_pred_2 = set_intersection_size(in_2, G2.pred[m]);
-    if (subisomorphism && card_pred_1 != card_pred_2) return false;
-    if (subisomorphism && card_pred_1 > card_pred_2) return false;
-    return true;
+  void reset(uint64_t _db_version) {
+    db_version = _db_version;
+    entry.clear();
+    bucket.clear();
   }
 
-  bool checkOutRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
-    int card_succ_1 = set_intersection_size(out_1, G1.succ[n]);
-    int card_succ_2 = set_intersection_size(out_2, G2.succ[m]);
-    if (!subisomorphism && card_succ_1 != card_succ_2) return false;
-    if (subisomorphism && card_succ_1 > card_succ_2) return false;
-    int card_pred_1 = set_intersection_size(out_1, G1.pred[n]);
-    int card_pred_2 = set_intersection_size(out_2, G2.pred[m]);
-    if (!subisomorphism && card_pred_1 != card_pred_2) return false;
-    if (subisomorphism && card_pred_1 > card_pred_2) return false;
-    return true;
+  const Entry *find(const vector<int32_t> &form, MatchMode mode) const {
+    auto it = bucket.find(hash(form, mode));
+    if (it == bucket.end()) return NULL;
+    for (auto e: it->second) {
+      if (entry[e].mode == mode && entry[e].form == form) return &entry[e];
+    }
+    return NULL;
   }
 
-  set<VIndex> genComplementary(int count, const vector<VIndex> &core,
-                              const set<VIndex> &in, const set<VIndex> &out){
-    set<VIndex> res;
-    for (VIndex vid = 0; vid < count; vid++) {
-      if (core[vid] == NULL_VIndex && in.find(vid) == in.end() && out.find(vid) == out.end()) {
-        res.insert(vid);
-      }
+  void insert(const vector<int32_t> &form, MatchMode mode, const vector<int32_t> &graph,
+              int32_t filter, int32_t survivors) {
+    if (const Entry *e = find(form, mode)) {
+      Entry &old = entry[e - entry.data()];
+      old.graph = graph;
+      old.filter = filter;
+      old.survivors = survivors;
+      return;
     }
-    return res;
+    bucket[hash(form, mode)].push_back(entry.size());
+    entry.push_back(Entry{mode, filter, survivors, form, graph});
   }
 
-  bool checkNewRule(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
-    set<VIndex> _N1 = genComplementary(G1.vertex_count, core_1, in_1, out_1);
-    set<VIndex> _N2 = genComplementary(G2.vertex_count, core_2, in_2, out_2);
-    int card_pred_1 = set_intersection_size(G1.pred[n], _N1);
-    int card_pred_2 = set_intersection_size(G2.pred[m], _N2);
-    if (!subisomorphism && card_pred_1 != card_pred_2) return false;
-    if (subisomorphism && card_pred_1 > card_pred_2) return false;
-    int card_succ_1 = set_intersection_size(G1.succ[n], _N1);
-    int card_succ_2 = set_intersection_size(G2.succ[m], _N2);
-    if (!subisomorphism && card_succ_1 != card_succ_2) return false;
-    if (subisomorphism && card_succ_1 > card_succ_2) return false;
-    return true;
+  bool save(const char *path) const {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+    CacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.db_version = db_version;
+    header.entry_count = entry.size();
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    auto put = [&](const vector<int32_t> &list) {
+      int32_t length = list.size();
+      ok = ok && fwrite(&length, sizeof(length), 1, fp) == 1 &&
+           fwrite(list.data(), sizeof(int32_t), length, fp) == (size_t)length;
+    };
+    for (auto &e: entry) {
+      ok = ok && fwrite(&e.mode, sizeof(e.mode), 1, fp) == 1 &&
+           fwrite(&e.filter, sizeof(e.filter), 1, fp) == 1 &&
+           fwrite(&e.survivors, sizeof(e.survivors), 1, fp) == 1;
+      put(e.form);
+      put(e.graph);
+    }
+    return fclose(fp) == 0 && ok;
   }
 
-  bool checkSynRules(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
-    return checkPredRule(G1, G2, n, m) && checkSuccRule(G1, G2, n, m) &&
-           checkInRule(G1, G2, n, m) && checkOutRule(G1, G2, n, m) &&
-           checkNewRule(G1, G2, n, m);
+  bool load(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+    int64_t file_size = fileSize(fp);
+    CacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+              memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+              header.version == CACHE_VERSION && header.db_version == db_version;
+    auto get = [&](vector<int32_t> &list) {
+      int32_t length = 0;
+      ok = ok && fread(&length, sizeof(length), 1, fp) == 1 &&
+           fitsInFile(fp, file_size, length, sizeof(int32_t));
+      list.resize(ok ? length : 0);
+      ok = ok && fread(list.data(), sizeof(int32_t), length, fp) == (size_t)length;
+    };
+    for (int64_t k = 0; k < header.entry_count && ok; k++) {
+      Entry e;
+      ok = fread(&e.mode, sizeof(e.mode), 1, fp) == 1 &&
+           fread(&e.filter, sizeof(e.filter), 1, fp) == 1 &&
+           fread(&e.survivors, sizeof(e.survivors), 1, fp) == 1;
+      get(e.form);
+      get(e.graph);
+      if (ok) insert(e.form, (MatchMode)e.mode, e.graph, e.filter, e.survivors);
+    }
+    fclose(fp);
+    if (!ok) reset(db_version);
+    return ok;
   }
+};
 
-  bool checkSemRules(const Graph &G1, const Graph &G2, VIndex n, VIndex m) {
-    // node attributes
-    if (G1.vertex[n] != G2.vertex[m]) return false;
-    // branch attributes
-    // move it to checkSuccRule and checkPredRule
-    return true;
+/*
+* Work-stealing scheduler for independent tasks 0 .. task_count - 1
+*
+* Every worker owns a contiguous range of task ids and takes tasks from the
+* front of it one at a time. A worker whose range runs dry steals the back
+* half of the largest remaining range. A few exploding tasks therefore never
+* leave the other threads idle, while neighboring tasks (the same query
+* against consecutive database graphs) mostly stay on one thread.
+*
+* Attributes
+* ----------
+* lo, hi: vector, length = worker count, the range [lo, hi) a worker still owns
+* lock: vector, length = worker count, guards lo and hi of each worker
+*
+* Methods
+* -------
+* run: call `task(id, worker)` for every task id, return when all are done
+* next: pop the next task of a worker, stealing when its range is empty
+*/
+struct Scheduler {
+  vector<long long> lo, hi;
+  vector<mutex> lock;
+
+  Scheduler(int worker_count): lo(worker_count), hi(worker_count), lock(worker_count) {}
+
+  bool next(int worker, long long &id) {
+    {
+      lock_guard<mutex> guard(lock[worker]);
+      if (lo[worker] < hi[worker]) {
+        id = lo[worker]++;
+        return true;
+      }
+    }
+    while (true) {
+      int victim = -1;
+      long long most = 0;
+      for (int w = 0; w < (int)lo.size(); w++) {
+        lock_guard<mutex> guard(lock[w]);
+        if (hi[w] - lo[w] > most) most = hi[w] - lo[w], victim = w;
+      }
+      if (victim < 0) return false;
+      long long from, to;
+      {
+        lock_guard<mutex> guard(lock[victim]);
+        if (hi[victim] <= lo[victim]) continue;
+        to = hi[victim];
+        from = hi[victim] - (hi[victim] - lo[victim] + 1) / 2;
+        hi[victim] = from;
+      }
+      lock_guard<mutex> guard(lock[worker]);
+      id = from;
+      lo[worker] = from + 1;
+      hi[worker] = to;
+      return true;
+    }
   }
 
-  void printMapping() {
-    printf("%s mapping relationship found:\n", subisomorphism?
-          "Subgraph isomorphism": "Isomorphism");
-    for (auto i = 0; i < vertex_count; i++) {
-      printf("%d %d\n", i, core_1[i]);
+  void run(long long task_count, const function<void(long long, int)> &task) {
+    int worker_count = lo.size();
+    for (int w = 0; w < worker_count; w++) {
+      lo[w] = task_count * w / worker_count;
+      hi[w] = task_count * (w + 1) / worker_count;
     }
+    auto work = [&](int worker) {
+      long long id;
+      while (next(worker, id)) task(id, worker);
+    };
+    vector<thread> threads;
+    for (int w = 1; w < worker_count; w++) threads.push_back(thread(work, w));
+    work(0);
+    for (auto &t: threads) t.join();
   }
 };
 
-bool solve(const Graph &G1, const Graph &G2, State &state) {
-    // If M(s) covers all the nodes of G2 then output M(s)
-    if (state.M1.size() == state.vertex_count) {
-      // state.printMapping();
-      return true;
+/*
+* The (query, database graph) pairs that pass all pre-filters, as ids
+* q * database.size() + g in increasing order, for the queries q with
+* selected[q] set, all of them if `selected` is NULL. The path and fragment
+* indexes are skipped when they have not been built.
+*/
+vector<long long> candidatePairs(const GraphSet &query, const GraphSet &database,
+                                 const LabelFilter &filter, const PathIndex &paths,
+                                 const FragmentIndex &fragments, MatchMode mode,
+                                 const vector<char> *selected = NULL) {
+  long long db_size = database.size();
+  vector<long long> pairs;
+  for (size_t q = 0; q < query.size(); q++) {
+    if (selected && !(*selected)[q]) continue;
+    vector<char> pass = filter.candidates(query[q], mode == ISOMORPHISM);
+    if (paths.graph_count == db_size) {
+      vector<char> mask(db_size, 0);
+      for (auto g: paths.candidates(query[q])) mask[g] = pass[g];
+      pass.swap(mask);
     }
-    // Compute the set P(s) of the pairs candidate for inclusion in M(s)
-    vector<pair<VIndex, VIndex>> P = state.genCandiPairSet();
-    // For each p in P(s)
-    //   If the feasibility rules succeed for the inclusion of p in M(s) then
-    //   Compute the state s' obtained by adding p to M(s)
-    //   Call solve(s')
-    for (auto p: P) {
-      VIndex n = p.first;
-      VIndex m = p.second;
-      if (state.checkSemRules(G1, G2, n, m) && state.checkSynRules(G1, G2, n, m)) {
-        State new_state = state;
-        new_state.addNewPair(n, m, G1.pred[n], G2.pred[m], G1.succ[n], G2.succ[m]);
-        if (solve(G1, G2, new_state)) return true;
+    if (fragments.graph_count == db_size) {
+      vector<char> mask(db_size, 0);
+      for (auto g: fragments.candidates(query[q])) mask[g] = pass[g];
+      pass.swap(mask);
+    }
+    for (int g = 0; g < db_size; g++) if (pass[g]) pairs.push_back(q * db_size + g);
+  }
+  return pairs;
+}
+
+/*
+* Count up to `limit` mappings of G1 to G2 (0 for all of them) with the
+* search tree split over the threads of `work`, one workspace per thread.
+*
+* The split depth grows until the states of that depth, the roots of the
+* subtrees, number at least SPLIT_FANOUT per thread or the depth reaches
+* the last query vertex. The subtrees are then scheduled as tasks, so idle
+* threads steal the ones left, and all of them stop once `limit` mappings
+* were found between them.
+*/
+const int SPLIT_FANOUT = 16;
+
+long long splitSearch(MatchMode mode, const Graph &G1, const Graph &G2, const QueryPlan &plan,
+                      long long limit, vector<TargetWorkspace> &work) {
+  if (G1.vertex_count < 2) {
+    SearchControl control(limit);
+    runSearch(mode, G1, G2, plan, control, &work[0]);
+    return control.count;
+  }
+  // every subtree is a search of its own, the domains are listed once
+  vector<vector<VIndex>> domain;
+  if (!listDomains(mode, G1, G2, plan, work[0], domain)) return 0;
+  for (auto &w: work) w.domain = &domain;
+  int thread_count = work.size(), depth = 0;
+  vector<VIndex> prefixes;
+  while (++depth < G1.vertex_count) {
+    SearchControl control(0);
+    control.split_depth = depth;
+    control.prefixes = &prefixes;
+    prefixes.clear();
+    runSearch(mode, G1, G2, plan, control, &work[0]);
+    if ((long long)prefixes.size() >= (long long)depth * SPLIT_FANOUT * thread_count) break;
+  }
+  if (depth == G1.vertex_count) depth--;
+  atomic<long long> total(0);
+  Scheduler scheduler(thread_count);
+  scheduler.run(prefixes.size() / depth, [&](long long task, int worker) {
+    if (limit && total.load(memory_order_relaxed) >= limit) return;
+    SearchControl control(limit);
+    control.shared = &total;
+    control.split_depth = depth;
+    control.start = prefixes.data() + task * depth;
+    runSearch(mode, G1, G2, plan, control, &work[worker]);
+  });
+  for (auto &w: work) w.domain = NULL;
+  // subtrees running side by side may overshoot the limit together
+  return limit ? min<long long>(total, limit) : (long long)total;
+}
+
+/*
+* Match the candidate `pairs` (see candidatePairs) on `thread_count`
+* threads, counting up to `limit` mappings per pair (0 for all of them; 1
+* decides whether the pair matches). Returns result[q * database.size() + g],
+* the count for query q and database graph g, 0 for the pairs not searched,
+* so the output does not depend on how the tasks were scheduled.
+*
+* With several threads, a pair gives up once its search has added
+* SPLIT_BUDGET pairs; the few pairs that did are searched again afterwards,
+* one at a time with the tree split over all threads (see splitSearch), so
+* that one explosive search does not leave the other threads idle.
+*/
+const long long SPLIT_BUDGET = 1 << 20;
+
+vector<long long> evaluate(const GraphSet &query, const vector<QueryPlan> &plan,
+                           const GraphSet &database, const vector<long long> &pairs,
+                           MatchMode mode, long long limit, int thread_count) {
+  long long db_size = database.size();
+  vector<long long> result(query.size() * db_size, 0);
+  vector<char> deferred(pairs.size(), 0);
+  Scheduler scheduler(thread_count);
+  vector<TargetWorkspace> work(thread_count);
+  scheduler.run(pairs.size(), [&](long long task, int worker) {
+    long long id = pairs[task];
+    int q = id / db_size, g = id % db_size;
+    SearchControl control(limit);
+    if (thread_count > 1) control.budget = SPLIT_BUDGET;
+    runSearch(mode, query[q], database[g], plan[q], control, &work[worker]);
+    if (control.exhausted) deferred[task] = 1;
+    else result[id] = control.count;
+  });
+  for (size_t task = 0; task < pairs.size(); task++) {
+    if (!deferred[task]) continue;
+    long long id = pairs[task];
+    int q = id / db_size, g = id % db_size;
+    result[id] = splitSearch(mode, query[q], database[g], plan[q], limit, work);
+  }
+  return result;
+}
+
+/*
+* Count the embeddings of G1 in a single large graph G2 on `thread_count`
+* threads. The candidates of the first vertex of the matching order root
+* independent searches; the Scheduler spreads them over the threads in
+* batches of ROOT_BATCH, each batch searched with one State in the
+* TargetWorkspace of its thread. The other domains are listed once, before
+* the batches, so a batch costs nothing in the size of G2 beyond its
+* search. G2 should have a label index.
+*/
+const int ROOT_BATCH = 64;
+
+long long countEmbeddings(const Graph &G1, const Graph &G2, const QueryPlan &plan,
+                          MatchMode mode, int thread_count) {
+  if (G1.vertex_count == 0) return 1;
+  VRange root = G2.withLabel(G1.vertex[plan.order[0]]);
+  vector<long long> count(thread_count, 0);
+  vector<TargetWorkspace> work(thread_count);
+  vector<vector<VIndex>> domain;
+  if (!listDomains(mode, G1, G2, plan, work[0], domain)) return 0;
+  // the batches take their roots from `root`, not from the listed domain
+  domain[plan.order[0]].clear();
+  for (auto &w: work) w.domain = &domain;
+  Scheduler scheduler(thread_count);
+  scheduler.run((root.size() + ROOT_BATCH - 1) / ROOT_BATCH, [&](long long task, int worker) {
+    VRange batch{root.begin() + task * ROOT_BATCH,
+                 root.begin() + min<long long>(root.size(), (task + 1) * ROOT_BATCH)};
+    count[worker] += findMappings(mode, G1, G2, plan, 0, Visitor(), &work[worker], &batch);
+  });
+  long long total = 0;
+  for (auto c: count) total += c;
+  return total;
+}
+
+/*
+* Microbenchmark of the intersection kernels: pairs of random sorted lists
+* of `n` values each, sharing about `share` of them, intersected by every
+* kernel the CPU supports. Prints nanoseconds per input value for counting
+* and for writing the intersection. Every kernel is first checked against
+* std::set_intersection on short lists of all lengths up to 70, a nearly a
+* subset of b (as the posting lists of a fragment and of its ancestor
+* are), written both to another buffer and in place.
+*/
+void benchmarkIntersect() {
+  mt19937 random(12345);
+  vector<IntersectKernel> kernels = intersectKernels();
+  printf("dispatched kernel: %s\n", intersectKernel().name);
+  for (auto &kernel: kernels) {
+    if (!kernelSupported(kernel)) continue;
+    int cases = 0, wrong = 0;
+    for (int length = 0; length <= 70; length++) {
+      for (int trial = 0; trial < 50; trial++) {
+        vector<int32_t> a, b, expect, out;
+        for (int v = 0; v < 2 * length + 8; v++) {
+          bool in_b = random() % 10 < 7;
+          if (in_b) b.push_back(v);
+          if ((int)a.size() < length && random() % 100 < (in_b ? 90 : 5)) a.push_back(v);
+        }
+        set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(expect));
+        out.resize(a.size());
+        size_t got = kernel.sorted(a.data(), a.size(), b.data(), b.size(), out.data());
+        bool ok = got == expect.size() && equal(expect.begin(), expect.end(), out.begin()) &&
+                  kernel.size(a.data(), a.size(), b.data(), b.size()) == expect.size();
+        got = kernel.sorted(a.data(), a.size(), b.data(), b.size(), a.data());
+        ok = ok && got == expect.size() && equal(expect.begin(), expect.end(), a.begin());
+        cases++;
+        wrong += !ok;
       }
     }
-    return false;
+    printf("%s: %d cases checked, %d wrong\n", kernel.name, cases, wrong);
+  }
+  printf("%8s %6s %8s %10s %10s\n", "n", "share", "kernel", "size ns", "sorted ns");
+  for (int n: {8, 32, 128, 1024, 16384}) {
+    for (double share: {0.01, 0.5}) {
+      // the lists are drawn from 2n - shared values, so they share `shared`
+      int shared = n * share, universe = 2 * n - shared;
+      vector<int32_t> pool(universe), a, b, out(n);
+      for (int i = 0; i < universe; i++) pool[i] = i * 3;
+      shuffle(pool.begin(), pool.end(), random);
+      a.assign(pool.begin(), pool.begin() + n);
+      b.assign(pool.begin() + n - shared, pool.end());
+      sort(a.begin(), a.end());
+      sort(b.begin(), b.end());
+      size_t expect = scalarSize(a.data(), n, b.data(), n);
+      int rounds = max(1, (1 << 24) / n);
+      for (auto &kernel: kernels) {
+        if (!kernelSupported(kernel)) continue;
+        size_t sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) sink += kernel.size(a.data(), n, b.data(), n);
+        auto middle = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) {
+          sink += kernel.sorted(a.data(), n, b.data(), n, out.data());
+        }
+        auto end = chrono::steady_clock::now();
+        size_t got = kernel.sorted(a.data(), n, b.data(), n, out.data());
+        bool ok = sink == 2 * rounds * expect && got == expect &&
+                  includes(a.begin(), a.end(), out.begin(), out.begin() + got) &&
+                  includes(b.begin(), b.end(), out.begin(), out.begin() + got);
+        double scale = 1e9 / ((double)rounds * n);
+        printf("%8d %6.2f %8s %10.3f %10.3f%s\n", n, share, kernel.name,
+               chrono::duration<double>(middle - start).count() * scale,
+               chrono::duration<double>(end - middle).count() * scale, ok ? "" : "  WRONG");
+      }
+    }
+  }
+}
+
+/*
+* Check of the matchers against brute force on random small graphs
+*
+* Every trial draws a target of at most 7 vertices and a query of at most
+* 6: random graphs with parallel edges of different labels, symmetric ones
+* (cycles, stars and cliques of one label), and queries cut out of the
+* target or relabeled copies of it, so that mappings exist. The reference
+* tries every injective map of the query vertices, with the edges of a
+* vertex pair collapsed into the one of smallest label as GraphSet does.
+* Every matching mode is run with and without -lad, with and without the
+* query bit masks, and through the label index, splitSearch and
+* countEmbeddings; the mappings visited must be the reference ones. Canonical
+* forms must be equal exactly for the isomorphic pairs. Prints the number
+* of cases and of wrong answers of each check, and returns false if any.
+*/
+struct CheckGraph {
+  vector<VLabel> label;
+  vector<Edge> edge;
+  map<pair<VIndex, VIndex>, ELabel> adj;
+
+  void add(VIndex u, VIndex v, ELabel l) {
+    edge.push_back(Edge(u, v, l));
+    auto it = adj.insert(make_pair(make_pair(u, v), l)).first;
+    it->second = min(it->second, l);
+  }
+
+  ELabel at(VIndex u, VIndex v) const {
+    auto it = adj.find(make_pair(u, v));
+    return it == adj.end() ? NULL_ELabel : it->second;
+  }
+};
+
+static CheckGraph randomCheckGraph(mt19937 &random, int count) {
+  CheckGraph G;
+  int kind = random() % 4, labels = 1 + random() % 2;
+  for (VIndex u = 0; u < count; u++) G.label.push_back(kind == 0 ? 0 : random() % labels);
+  if (kind == 0) {
+    // one label everywhere, shaped to have many automorphisms
+    int shape = random() % 3;
+    for (VIndex u = 0; u < count; u++) {
+      for (VIndex v = 0; v < count; v++) {
+        bool edge = shape == 0 ? (v == (u + 1) % count || u == (v + 1) % count) :
+                    shape == 1 ? (u == 0) != (v == 0) : u != v;
+        if (edge && u != v) G.add(u, v, 0);
+      }
+    }
+    return G;
+  }
+  int edges = random() % (count * count + 1);
+  for (int i = 0; i < edges; i++) {
+    VIndex u = random() % count, v = random() % count;
+    if (u == v) continue;
+    G.add(u, v, random() % 2);
+    // a parallel edge with the other label
+    if (random() % 4 == 0) G.add(u, v, 1 - G.edge.back().label);
+  }
+  return G;
+}
+
+// the induced subgraph of G on `count` random vertices, renumbered, keeping
+// every edge for isomorphism and induced queries, some of them otherwise
+static CheckGraph cutCheckGraph(mt19937 &random, const CheckGraph &G, int count, bool all) {
+  vector<VIndex> vertex(G.label.size()), position(G.label.size(), NULL_VIndex);
+  for (size_t u = 0; u < vertex.size(); u++) vertex[u] = u;
+  shuffle(vertex.begin(), vertex.end(), random);
+  vertex.resize(count);
+  CheckGraph Q;
+  for (int i = 0; i < count; i++) position[vertex[i]] = i, Q.label.push_back(G.label[vertex[i]]);
+  for (auto &e: G.adj) {
+    VIndex u = position[e.first.first], v = position[e.first.second];
+    if (u != NULL_VIndex && v != NULL_VIndex && (all || random() % 3)) Q.add(u, v, e.second);
+  }
+  return Q;
 }
 
-bool isomorphism(const Graph &G1, const Graph &G2) {
-  if (G1.vertex_count != G2.vertex_count) return false;
-  if (G1.edge_count != G2.edge_count) return false;
-  State state(G1.vertex_count, 0);
-  return solve(G1, G2, state);
+static void bruteMappings(const CheckGraph &A, const CheckGraph &B, MatchMode mode,
+                          vector<VIndex> &mapping, vector<char> &used, set<vector<VIndex>> &found) {
+  VIndex u = 0;
+  while (u < (VIndex)mapping.size() && mapping[u] != NULL_VIndex) u++;
+  if (u == (VIndex)mapping.size()) {
+    found.insert(mapping);
+    return;
+  }
+  for (VIndex v = 0; v < (VIndex)B.label.size(); v++) {
+    if (used[v] || A.label[u] != B.label[v]) continue;
+    bool ok = true;
+    for (VIndex w = 0; w < u && ok; w++) {
+      ELabel a[2] = {A.at(u, w), A.at(w, u)}, b[2] = {B.at(v, mapping[w]), B.at(mapping[w], v)};
+      for (int k = 0; k < 2 && ok; k++) {
+        ok = mode == MONOMORPHISM ? a[k] == NULL_ELabel || a[k] == b[k] : a[k] == b[k];
+      }
+    }
+    if (!ok) continue;
+    mapping[u] = v, used[v] = 1;
+    bruteMappings(A, B, mode, mapping, used, found);
+    mapping[u] = NULL_VIndex, used[v] = 0;
+  }
 }
 
-bool subisomorphism(const Graph &G1, const Graph &G2) {
-  if (G1.vertex_count > G2.vertex_count) return false;
-  if (G1.edge_count > G2.edge_count) return false;
-  State state(G1.vertex_count, 1);
-  return solve(G1, G2, state);
+bool selfCheck() {
+  mt19937 random(12345);
+  const char *name[] = {"isomorphism", "induced", "monomorphism"};
+  enum { MASKS, NO_MASKS, LAD, LABEL_INDEX, LIMIT, SPLIT, EMBEDDINGS, CHECK_COUNT };
+  const char *check[] = {"findMappings", "findMappings, no masks", "findMappings -lad",
+                         "findMappings, label index", "findMappings, limit 1", "splitSearch",
+                         "countEmbeddings"};
+  long long cases[3][CHECK_COUNT] = {{0}}, wrong[3][CHECK_COUNT] = {{0}};
+  long long form_cases = 0, form_wrong = 0;
+  vector<TargetWorkspace> work(2);
+  for (int trial = 0; trial < 3000; trial++) {
+    int count2 = 1 + random() % 7;
+    CheckGraph B = randomCheckGraph(random, count2), A;
+    int kind = random() % 3, count1 = 1 + random() % min(count2, 6);
+    if (kind == 0) A = randomCheckGraph(random, count1);
+    else A = cutCheckGraph(random, B, kind == 1 ? count2 : count1, random() % 2);
+    GraphSet graphs;
+    for (auto *G: {&A, &B}) {
+      graphs.storage[VERTEX_LABEL].insert(graphs.storage[VERTEX_LABEL].end(), G->label.begin(),
+                                          G->label.end());
+      vector<Edge> edge(G->edge);
+      graphs.addGraph(G->label.size(), edge);
+    }
+    graphs.link();
+    vector<int> label_count = countLabels(graphs);
+    set<vector<VIndex>> expect[3];
+    for (int mode = ISOMORPHISM; mode <= MONOMORPHISM; mode++) {
+      if (mode == ISOMORPHISM && A.label.size() != B.label.size()) continue;
+      vector<VIndex> mapping(A.label.size(), NULL_VIndex);
+      vector<char> used(B.label.size(), 0);
+      bruteMappings(A, B, (MatchMode)mode, mapping, used, expect[mode]);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+      // the second pass runs with the label index, which countEmbeddings needs
+      if (pass) graphs.indexLabels();
+      const Graph &G1 = graphs[0], &G2 = graphs[1];
+      QueryPlan plan = makeQueryPlan(G1, label_count);
+      for (int mode = ISOMORPHISM; mode <= MONOMORPHISM; mode++) {
+        MatchMode m = (MatchMode)mode;
+        long long total = expect[mode].size();
+        auto verify = [&](int c, const QueryPlan &p) {
+          set<vector<VIndex>> found;
+          long long n = findMappings(m, G1, G2, p, 0, [&](const vector<VIndex> &mapping) {
+            found.insert(mapping);
+            return true;
+          });
+          cases[mode][c]++;
+          wrong[mode][c] += n != total || found != expect[mode];
+        };
+        if (pass) {
+          verify(LABEL_INDEX, plan);
+          cases[mode][EMBEDDINGS]++;
+          wrong[mode][EMBEDDINGS] += countEmbeddings(G1, G2, plan, m, 2) != total;
+          continue;
+        }
+        verify(MASKS, plan);
+        QueryPlan bare = plan;
+        bare.words = 0;
+        verify(NO_MASKS, bare);
+        QueryPlan lad = plan;
+        lad.propagate = true;
+        verify(LAD, lad);
+        cases[mode][LIMIT]++;
+        wrong[mode][LIMIT] += findMappings(m, G1, G2, plan, 1) != min(total, 1LL);
+        cases[mode][SPLIT]++;
+        wrong[mode][SPLIT] += splitSearch(m, G1, G2, plan, 0, work) != total;
+      }
+    }
+    if (A.label.size() == B.label.size()) {
+      bool same = CanonicalLabeling(graphs[0]).form() == CanonicalLabeling(graphs[1]).form();
+      form_cases++;
+      form_wrong += same != !expect[ISOMORPHISM].empty();
+    }
+  }
+  long long total_wrong = form_wrong;
+  for (int mode = 0; mode < 3; mode++) {
+    for (int c = 0; c < CHECK_COUNT; c++) {
+      printf("%s, %s: %lld cases checked, %lld wrong\n", check[c], name[mode], cases[mode][c],
+             wrong[mode][c]);
+      total_wrong += wrong[mode][c];
+    }
+  }
+  printf("canonical forms: %lld cases checked, %lld wrong\n", form_cases, form_wrong);
+  return total_wrong == 0;
 }
 
-int main() {
-  // freopen("graphDB/smalldb.data", "r", stdin);
-  freopen("graphDB/mygraphdb.data", "r", stdin);
-  readGraph(database, 10000);
+int main(int argc, char **argv) {
+  int thread_count = thread::hardware_concurrency();
+  // const char *db_path = "graphDB/smalldb.data";
+  const char *db_path = "graphDB/mygraphdb.data";
+  // -count: report the number of mappings of every matching pair,
+  // up to -limit per pair (0 for all of them)
+  bool count_mappings = false;
+  long long limit = 0;
+  // -lad: neighborhood all-different filtering of the candidate domains
+  bool propagate = false;
+  // -paths: file of the label path index, built and saved if missing
+  const char *path_index = NULL;
+  int path_length = 4;
+  // -fragments: file of the fragment index, mined and saved if missing
+  const char *fragment_index = NULL;
+  // -cache: file of the query result cache, loaded and saved back
+  const char *cache_path = NULL;
+  // -graph: count the embeddings of the queries in one large graph
+  const char *graph_path = NULL;
+  MatchMode mode = ISOMORPHISM;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-t") && i + 1 < argc) thread_count = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-db") && i + 1 < argc) db_path = argv[++i];
+    else if (!strcmp(argv[i], "-count")) count_mappings = true;
+    else if (!strcmp(argv[i], "-induced")) mode = INDUCED_SUBGRAPH;
+    else if (!strcmp(argv[i], "-mono")) mode = MONOMORPHISM;
+    else if (!strcmp(argv[i], "-lad")) propagate = true;
+    else if (!strcmp(argv[i], "-paths") && i + 1 < argc) path_index = argv[++i];
+    else if (!strcmp(argv[i], "-pathlen") && i + 1 < argc) path_length = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-fragments") && i + 1 < argc) fragment_index = argv[++i];
+    else if (!strcmp(argv[i], "-cache") && i + 1 < argc) cache_path = argv[++i];
+    else if (!strcmp(argv[i], "-graph") && i + 1 < argc) graph_path = argv[++i];
+    else if (!strcmp(argv[i], "-limit") && i + 1 < argc) limit = atoll(argv[++i]);
+    else if (!strcmp(argv[i], "-benchmark")) {
+      benchmarkIntersect();
+      return 0;
+    }
+    else if (!strcmp(argv[i], "-selfcheck")) return selfCheck() ? 0 : 1;
+    else if (!strcmp(argv[i], "-convert") && i + 2 < argc) {
+      // text database -> binary database
+      loadGraphSet(database, argv[i + 1], -1);
+      if (!database.save(argv[i + 2])) {
+        fprintf(stderr, "cannot write %s\n", argv[i + 2]);
+        return 1;
+      }
+      return 0;
+    }
+  }
+  if (thread_count < 1) thread_count = 1;
   string filename[] = {"graphDB/Q24.my", "graphDB/Q20.my", "graphDB/Q16.my",
   "graphDB/Q12.my", "graphDB/Q8.my", "graphDB/Q4.my"};
   // string filename[] = {"graphDB/smallQ.my"};
+  if (graph_path) {
+    // colors are only used by isomorphism, which a pattern search never is
+    database.refine = false;
+    loadGraphSet(database, graph_path, 1);
+    database.indexLabels();
+    if (mode == ISOMORPHISM) mode = MONOMORPHISM;
+    vector<int> label_count = countLabels(database);
+    for (auto s: filename) {
+      loadGraphSet(query, s.c_str(), 1000);
+      time_t start_time = 0, end_time = 0;
+      time(&start_time);
+      long long total = 0;
+      for (size_t q = 0; q < query.size(); q++) {
+        // -lad is ignored: listing every domain over the whole graph for each
+        // batch of roots costs far more than the pruning saves
+        QueryPlan plan = makeQueryPlan(query[q], label_count);
+        long long count = countEmbeddings(query[q], database[0], plan, mode, thread_count);
+        if (count_mappings) printf("query %d: %lld embeddings\n", (int)q, count);
+        total += count;
+      }
+      time(&end_time);
+      printf("%lld embeddings\n", total);
+      printf("cost %ld seconds\n", end_time - start_time);
+    }
+    return 0;
+  }
+  loadGraphSet(database, db_path, 10000);
+  vector<int> label_count = countLabels(database);
+  LabelFilter filter;
+  filter.build(database);
+  CanonicalIndex index;
+  if (mode == ISOMORPHISM) index.build(database);
+  PathIndex paths;
+  if (mode != ISOMORPHISM) {
+    if (!path_index || !paths.load(path_index, database.version(), path_length)) {
+      paths.build(database, path_length);
+      if (path_index && !paths.save(path_index)) fprintf(stderr, "cannot write %s\n", path_index);
+    }
+  }
+  FragmentIndex fragments;
+  if (mode != ISOMORPHISM && fragment_index) {
+    if (!fragments.load(fragment_index, database.version(), label_count)) {
+      fragments.build(database, label_count, 6, 0.1, 2);
+      if (!fragments.save(fragment_index)) fprintf(stderr, "cannot write %s\n", fragment_index);
+    }
+    printf("%d indexed fragments\n", (int)fragments.fragment.size());
+  }
+  // the filters a survivor count of the cache was taken with
+  int32_t filter_key = mode == ISOMORPHISM ? -1 :
+                       path_length * 2 + (fragments.graph_count == (int)database.size());
+  ResultCache cache;
+  cache.reset(database.version());
+  if (cache_path && cache.load(cache_path)) printf("%zu cached queries\n", cache.entry.size());
   for (auto s: filename) {
-    query.clear();
-    freopen(s.c_str(), "r", stdin);
-    readGraph(query, 1000);
+    loadGraphSet(query, s.c_str(), 1000);
+    vector<QueryPlan> plan;
+    for (auto &G1: query) {
+      plan.push_back(makeQueryPlan(G1, label_count));
+      plan.back().propagate = propagate;
+    }
     time_t start_time = 0, end_time = 0;
 
     time(&start_time);
-    for (auto G1: query) {
-      for (auto G2: database) {
-        isomorphism(G1, G2);
+    size_t db_size = database.size();
+    vector<long long> result(query.size() * db_size, 0);
+    if (count_mappings) {
+      vector<long long> pairs = candidatePairs(query, database, filter, paths, fragments, mode);
+      printf("%zu candidate pairs\n", pairs.size());
+      result = evaluate(query, plan, database, pairs, mode, limit, thread_count);
+    } else {
+      // a query isomorphic to one cached, or to an earlier one of this file,
+      // is answered by its canonical form, only the others are matched. The
+      // filters are reported over every query but only run on those, and on
+      // the hits cached with other filters
+      vector<vector<int32_t>> form(query.size());
+      vector<int> first(query.size(), -1);
+      vector<char> selected(query.size(), 0), filtered(query.size(), 0);
+      vector<long long> survivors(query.size(), 0);
+      map<vector<int32_t>, int> seen;
+      for (size_t q = 0; q < query.size(); q++) {
+        form[q] = CanonicalLabeling(query[q]).form();
+        if (const ResultCache::Entry *hit = cache.find(form[q], mode)) {
+          for (auto g: hit->graph) result[q * db_size + g] = 1;
+          filtered[q] = hit->filter != filter_key;
+          survivors[q] = hit->survivors;
+          continue;
+        }
+        auto it = seen.insert(make_pair(form[q], (int)q));
+        first[q] = it.first->second;
+        selected[q] = filtered[q] = it.second;
+      }
+      if (mode == ISOMORPHISM) {
+        // deciding isomorphism takes one lookup in the canonical index
+        for (size_t q = 0; q < query.size(); q++) {
+          if (!selected[q]) continue;
+          for (auto g: index.lookup(form[q])) result[q * db_size + g] = 1;
+        }
+      } else {
+        vector<long long> pairs = candidatePairs(query, database, filter, paths, fragments,
+                                                 mode, &filtered);
+        for (size_t q = 0; q < query.size(); q++) if (filtered[q]) survivors[q] = 0;
+        vector<long long> searched;
+        for (auto id: pairs) {
+          survivors[id / db_size]++;
+          if (selected[id / db_size]) searched.push_back(id);
+        }
+        long long candidate_count = 0;
+        for (size_t q = 0; q < query.size(); q++) {
+          if (first[q] >= 0) survivors[q] = survivors[first[q]];
+          candidate_count += survivors[q];
+        }
+        printf("%lld candidate pairs\n", candidate_count);
+        printf("%zu searched pairs\n", searched.size());
+        vector<long long> found = evaluate(query, plan, database, searched, mode, 1, thread_count);
+        for (auto id: searched) result[id] = found[id];
+      }
+      for (size_t q = 0; q < query.size(); q++) {
+        if (!filtered[q] && first[q] < 0) continue;
+        if (first[q] >= 0 && !selected[q]) {
+          copy(result.begin() + first[q] * db_size, result.begin() + (first[q] + 1) * db_size,
+               result.begin() + q * db_size);
+          continue;
+        }
+        vector<int32_t> graph;
+        for (size_t g = 0; g < db_size; g++) if (result[q * db_size + g]) graph.push_back(g);
+        cache.insert(form[q], mode, graph, filter_key, survivors[q]);
       }
     }
     time(&end_time);
-    printf("cost %ld seconds\n", end_time - start_time);
-/*
-    time(&start_time);
-    int gcnt = 0, cnt = 0;
-    for (auto G1: query) {
-      for (auto G2: database) {
-        cnt += subisomorphism(G1, G2);
-      }
-      gcnt++;
-      if (gcnt % 10 == 0) {
-        time(&end_time);
-        printf("cost %ld seconds\n", end_time - start_time);
+    long long pair_count = 0, mapping_count = 0;
+    for (size_t id = 0; id < result.size(); id++) {
+      if (!result[id]) continue;
+      pair_count++;
+      mapping_count += result[id];
+      if (count_mappings) {
+        printf("query %d graph %d: %lld mappings\n", (int)(id / database.size()),
+               (int)(id % database.size()), result[id]);
       }
     }
-    printf("%d\n", cnt);
-*/
+    printf("%lld matching pairs\n", pair_count);
+    if (count_mappings) printf("%lld mappings\n", mapping_count);
+    printf("cost %ld seconds\n", end_time - start_time);
   }
+  if (cache_path && !cache.save(cache_path)) fprintf(stderr, "cannot write %s\n", cache_path);
   return 0;
 }